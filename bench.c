@@ -0,0 +1,995 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cache.h"
+#include "jbod.h"
+#include "mdadm.h"
+#include "bench.h"
+#include "keysearch.h"
+#include "tester.h"
+
+#define BENCH_ARGUMENTS "hm:i:s:f:R:"
+#define USAGE                                               \
+  "USAGE: bench [-h] [-m mode] [-i iterations] [-s sizes]\n" \
+  "             [-f format] [-R rate] [trace-file ...]\n"    \
+  "\n"                                                      \
+  "where:\n"                                                \
+  "    -h - help mode (display this message)\n"             \
+  "    -m - benchmark to run: lookup (default), policy,\n"  \
+  "         layout, keysearch, assoc, replay, mrc, open,\n"  \
+  "         warm\n"                                          \
+  "    -i - replay: runs of each trace (default: 5)\n"      \
+  "    -s - replay: comma-separated cache sizes, 0 for no\n" \
+  "         cache (default: 0,64,1024,4096); warm: cache\n"   \
+  "         sizes (default: 1024)\n"                         \
+  "    -f - replay: output format, csv (default) or json\n" \
+  "    -R - mrc: fraction of blocks sampled (default: 1)\n"  \
+  "         mrc prints every size from 2 to 4096 unless -s\n" \
+  "         is given\n"                                       \
+  "\n"                                                      \
+  "Trace-driven modes default to every file in traces/.\n"  \
+
+#define NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define LOOKUP_QUERIES (1 << 20)
+
+static char *default_traces[] = {
+  "traces/simple-input",
+  "traces/linear-input",
+  "traces/random-input",
+  "traces/scan-input",
+};
+#define NUM_DEFAULT_TRACES (sizeof(default_traces) / sizeof(default_traces[0]))
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int equals(const char *s1, const char *s2) {
+  return strncmp(s1, s2, strlen(s2)) == 0;
+}
+
+int trace_load(const char *path, trace_op_t **ops) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+  int n = 0, cap = 1024, line_num = 0;
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", path);
+
+  trace_op_t *v = malloc(cap * sizeof(trace_op_t));
+  while (fgets(line, sizeof(line), f)) {
+    ++line_num;
+    if (n == cap)
+      v = realloc(v, (cap *= 2) * sizeof(trace_op_t));
+    trace_op_t *op = &v[n++];
+    memset(op, 0, sizeof(*op));
+    if (equals(line, "MOUNT")) {
+      op->cmd = TRACE_MOUNT;
+    } else if (equals(line, "UNMOUNT")) {
+      op->cmd = TRACE_UNMOUNT;
+    } else if (equals(line, "SIGNALL")) {
+      op->cmd = TRACE_SIGNALL;
+    } else {
+      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+        errx(1, "Failed to parse command on line %d of %s, aborting.", line_num, path);
+      if (equals(cmd, "READ"))
+        op->cmd = TRACE_READ;
+      else if (equals(cmd, "WRITE"))
+        op->cmd = TRACE_WRITE;
+      else
+        errx(1, "Unknown command on line %d of %s, aborting.", line_num, path);
+      op->addr = addr;
+      op->len = len;
+      op->ch = ch;
+    }
+  }
+  fclose(f);
+
+  *ops = v;
+  return n;
+}
+
+/* Small deterministic PRNG so runs are comparable across commits. */
+static uint32_t bench_seed = 2463534242u;
+
+static uint32_t bench_rand(void) {
+  bench_seed ^= bench_seed << 13;
+  bench_seed ^= bench_seed >> 17;
+  bench_seed ^= bench_seed << 5;
+  return bench_seed;
+}
+
+/* Fills |keys| with a random permutation of all block keys. */
+static void shuffle_keys(int *keys) {
+  for (int i = 0; i < NUM_KEYS; i++)
+    keys[i] = i;
+  for (int i = NUM_KEYS - 1; i > 0; i--) {
+    int j = bench_rand() % (i + 1);
+    int t = keys[i];
+    keys[i] = keys[j];
+    keys[j] = t;
+  }
+}
+
+/* An entry as cache.c stored them before it split keys from payloads: the
+ * block inline with its key. */
+typedef struct {
+  bool valid;
+  int disk_num;
+  int block_num;
+  uint8_t block[JBOD_BLOCK_SIZE];
+  int access_time;
+} inline_entry_t;
+
+/* The lookup cache.c used before it had an index: compare every entry. */
+static int scan_lookup(inline_entry_t *entries, int n, int disk_num,
+                       int block_num, uint8_t *buf) {
+  int rc = -1;
+  for (int i = 0; i < n; i++) {
+    if (entries[i].valid && entries[i].disk_num == disk_num &&
+        entries[i].block_num == block_num) {
+      memcpy(buf, entries[i].block, JBOD_BLOCK_SIZE);
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+void bench_lookup(void) {
+  static int keys[NUM_KEYS];
+  int *queries = malloc(LOOKUP_QUERIES * sizeof(int));
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+
+  printf("%8s %16s %16s %8s\n", "entries", "scan lookups/s", "index lookups/s", "speedup");
+  for (int size = 64; size <= 4096; size *= 2) {
+    shuffle_keys(keys);
+
+    /* Half of the queries hit, half go to blocks that are not cached. */
+    for (int i = 0; i < LOOKUP_QUERIES; i++) {
+      int k = bench_rand() % size;
+      if (i & 1 && size < NUM_KEYS)
+        k = size + bench_rand() % (NUM_KEYS - size);
+      queries[i] = keys[k];
+    }
+
+    inline_entry_t *entries = calloc(size, sizeof(inline_entry_t));
+    if (cache_create(size) != 1)
+      errx(1, "Failed to create cache of %d entries.", size);
+    for (int i = 0; i < size; i++) {
+      entries[i].valid = true;
+      entries[i].disk_num = keys[i] / JBOD_NUM_BLOCKS_PER_DISK;
+      entries[i].block_num = keys[i] % JBOD_NUM_BLOCKS_PER_DISK;
+      cache_insert(entries[i].disk_num, entries[i].block_num, buf);
+    }
+
+    /* The scan is slow enough at large sizes that a slice of the queries
+     * gives a stable rate. */
+    int scan_queries = LOOKUP_QUERIES / (size / 64);
+    int hits = 0;
+    double start = bench_now();
+    for (int i = 0; i < scan_queries; i++)
+      hits += scan_lookup(entries, size, queries[i] / JBOD_NUM_BLOCKS_PER_DISK,
+                          queries[i] % JBOD_NUM_BLOCKS_PER_DISK, buf) == 1;
+    double scan_rate = scan_queries / (bench_now() - start);
+
+    start = bench_now();
+    for (int i = 0; i < LOOKUP_QUERIES; i++)
+      hits += cache_lookup(queries[i] / JBOD_NUM_BLOCKS_PER_DISK,
+                           queries[i] % JBOD_NUM_BLOCKS_PER_DISK, buf) == 1;
+    double index_rate = LOOKUP_QUERIES / (bench_now() - start);
+
+    printf("%8d %16.0f %16.0f %7.1fx\n", size, scan_rate, index_rate,
+           index_rate / scan_rate);
+    if (hits == 0)
+      errx(1, "Lookup benchmark did not hit any entry.");
+
+    cache_destroy();
+    free(entries);
+  }
+  free(queries);
+}
+
+/* Opens a hardware counter for this thread, or returns -1 if perf events are
+ * unavailable (no PMU, containers, perf_event_paranoid). */
+static int perf_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_start(int fd) {
+  if (fd != -1) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+/* Stops |fd| and returns its count, or -1 if it is not available. */
+static double perf_stop(int fd) {
+  uint64_t count;
+
+  if (fd == -1)
+    return -1;
+  ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(fd, &count, sizeof(count)) != sizeof(count))
+    return -1;
+  return count;
+}
+
+/* Prints one row of the layout benchmark; counters that could not be read
+ * are shown as n/a. */
+static void print_layout_row(int size, const char *layout, int queries,
+                             double seconds, double l1, double llc) {
+  char l1s[16] = "n/a", llcs[16] = "n/a";
+
+  if (l1 >= 0)
+    snprintf(l1s, sizeof(l1s), "%.2f", l1 / queries);
+  if (llc >= 0)
+    snprintf(llcs, sizeof(llcs), "%.2f", llc / queries);
+  printf("%8d %-9s %14.0f %12s %12s\n", size, layout, queries / seconds, l1s, llcs);
+}
+
+/* The same linear scan as scan_lookup, over packed keys kept apart from the
+ * payloads, the way cache.c lays out its slots. */
+static int scan_keys(const uint16_t *keys, const uint8_t *slab, int n, int key,
+                     uint8_t *buf) {
+  int rc = -1;
+  for (int i = 0; i < n; i++) {
+    if (keys[i] == key) {
+      memcpy(buf, slab + (size_t)i * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE);
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+void bench_layout(void) {
+  static int keys[NUM_KEYS];
+  int *queries = malloc(LOOKUP_QUERIES * sizeof(int));
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+  int l1_fd = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                        PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  int llc_fd = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+  printf("%8s %-9s %14s %12s %12s\n", "entries", "layout", "lookups/s",
+         "L1D miss/op", "LLC miss/op");
+  for (int size = 64; size <= 4096; size *= 2) {
+    shuffle_keys(keys);
+    for (int i = 0; i < LOOKUP_QUERIES; i++) {
+      int k = bench_rand() % size;
+      if (i & 1 && size < NUM_KEYS)
+        k = size + bench_rand() % (NUM_KEYS - size);
+      queries[i] = keys[k];
+    }
+
+    /* Entries with the block inline. */
+    inline_entry_t *entries = aligned_alloc(64, size * sizeof(inline_entry_t));
+    /* Packed keys and a separate payload slab. */
+    uint16_t *packed = aligned_alloc(64, size * sizeof(uint16_t) + 64);
+    uint8_t *slab = aligned_alloc(64, (size_t)size * JBOD_BLOCK_SIZE);
+    memset(entries, 0, size * sizeof(inline_entry_t));
+    memset(slab, 0, (size_t)size * JBOD_BLOCK_SIZE);
+    if (cache_create(size) != 1)
+      errx(1, "Failed to create cache of %d entries.", size);
+    for (int i = 0; i < size; i++) {
+      entries[i].valid = true;
+      entries[i].disk_num = keys[i] / JBOD_NUM_BLOCKS_PER_DISK;
+      entries[i].block_num = keys[i] % JBOD_NUM_BLOCKS_PER_DISK;
+      packed[i] = keys[i];
+      cache_insert(entries[i].disk_num, entries[i].block_num, buf);
+    }
+
+    int scan_queries = LOOKUP_QUERIES / (size / 64);
+    int hits = 0;
+    double start = bench_now();
+    perf_start(l1_fd);
+    perf_start(llc_fd);
+    for (int i = 0; i < scan_queries; i++)
+      hits += scan_lookup(entries, size, queries[i] / JBOD_NUM_BLOCKS_PER_DISK,
+                          queries[i] % JBOD_NUM_BLOCKS_PER_DISK, buf) == 1;
+    double l1 = perf_stop(l1_fd), llc = perf_stop(llc_fd);
+    print_layout_row(size, "aos-scan", scan_queries, bench_now() - start, l1, llc);
+
+    start = bench_now();
+    perf_start(l1_fd);
+    perf_start(llc_fd);
+    for (int i = 0; i < scan_queries; i++)
+      hits += scan_keys(packed, slab, size, queries[i], buf) == 1;
+    l1 = perf_stop(l1_fd);
+    llc = perf_stop(llc_fd);
+    print_layout_row(size, "soa-scan", scan_queries, bench_now() - start, l1, llc);
+
+    start = bench_now();
+    perf_start(l1_fd);
+    perf_start(llc_fd);
+    for (int i = 0; i < LOOKUP_QUERIES; i++)
+      hits += cache_lookup(queries[i] / JBOD_NUM_BLOCKS_PER_DISK,
+                           queries[i] % JBOD_NUM_BLOCKS_PER_DISK, buf) == 1;
+    l1 = perf_stop(l1_fd);
+    llc = perf_stop(llc_fd);
+    print_layout_row(size, "index", LOOKUP_QUERIES, bench_now() - start, l1, llc);
+    if (hits == 0)
+      errx(1, "Layout benchmark did not hit any entry.");
+
+    cache_destroy();
+    free(entries);
+    free(packed);
+    free(slab);
+  }
+  if (l1_fd != -1)
+    close(l1_fd);
+  if (llc_fd != -1)
+    close(llc_fd);
+  free(queries);
+}
+
+#define KEYSEARCH_PROBES (1 << 22)
+
+void bench_keysearch(void) {
+  static const int widths[] = { 8, 16, 32, 64 };
+  keysearch_impl_t best = keysearch_selected();
+  uint16_t keys[64];
+  uint16_t *probes = malloc(KEYSEARCH_PROBES * sizeof(uint16_t));
+
+  for (int i = 0; i < 64; i++)
+    keys[i] = bench_rand() % NUM_KEYS;
+
+  printf("%6s %-7s %14s %14s\n", "keys", "impl", "hit probes/s", "miss probes/s");
+  for (int w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+    int n = widths[w];
+    for (int impl = 0; impl < KEYSEARCH_NUM_IMPLS; impl++) {
+      if (keysearch_select(impl) != 1)
+        continue;
+      double rates[2];
+      for (int miss = 0; miss < 2; miss++) {
+        /* Hits land anywhere in the set; misses use keys outside it. */
+        for (int i = 0; i < KEYSEARCH_PROBES; i++)
+          probes[i] = miss ? NUM_KEYS + bench_rand() % 1024 : keys[bench_rand() % n];
+        int found = 0;
+        double start = bench_now();
+        for (int i = 0; i < KEYSEARCH_PROBES; i++)
+          found += keysearch_find(keys, n, probes[i]) != -1;
+        rates[miss] = KEYSEARCH_PROBES / (bench_now() - start);
+        if (found != (miss ? 0 : KEYSEARCH_PROBES))
+          errx(1, "Key search returned wrong results.");
+      }
+      printf("%6d %-7s %14.0f %14.0f\n", n, keysearch_impl_name(impl), rates[0], rates[1]);
+    }
+  }
+  keysearch_select(best);
+  free(probes);
+}
+
+/* Feeds every block touched by a READ or WRITE through each of |caches| the
+ * way a look-aside cache in mdadm would: look it up, insert it on a miss. */
+static void replay_blocks(const trace_op_t *ops, int num_ops, cache_t **caches,
+                          int num_caches) {
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+
+  for (int i = 0; i < num_ops; i++) {
+    if (ops[i].cmd != TRACE_READ && ops[i].cmd != TRACE_WRITE)
+      continue;
+    if (ops[i].len == 0)
+      continue;
+    uint32_t first = ops[i].addr / JBOD_BLOCK_SIZE;
+    uint32_t last = (ops[i].addr + ops[i].len - 1) / JBOD_BLOCK_SIZE;
+    for (uint32_t b = first; b <= last; b++) {
+      int disk_num = b / JBOD_NUM_BLOCKS_PER_DISK;
+      int block_num = b % JBOD_NUM_BLOCKS_PER_DISK;
+      for (int c = 0; c < num_caches; c++)
+        if (cache_lookup_h(caches[c], disk_num, block_num, buf) == -1)
+          cache_insert_h(caches[c], disk_num, block_num, buf);
+    }
+  }
+}
+
+/* Replays each trace once through one cache per size and policy, all open
+ * side by side. */
+void bench_policy(char **traces, int num_traces) {
+  static const int sizes[] = { 64, 256, 1024, 4096 };
+  enum { NUM_SIZES = sizeof(sizes) / sizeof(sizes[0]) };
+  cache_t *caches[NUM_SIZES * CACHE_NUM_POLICIES];
+
+  for (int t = 0; t < num_traces; t++) {
+    trace_op_t *ops;
+    int num_ops = trace_load(traces[t], &ops);
+
+    for (int s = 0; s < NUM_SIZES; s++) {
+      for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+        cache_options_t options = { .policy = p };
+        caches[s * CACHE_NUM_POLICIES + p] = cache_open(sizes[s], &options);
+        if (caches[s * CACHE_NUM_POLICIES + p] == NULL)
+          errx(1, "Failed to create cache.");
+      }
+    }
+    replay_blocks(ops, num_ops, caches, NUM_SIZES * CACHE_NUM_POLICIES);
+
+    for (int s = 0; s < NUM_SIZES; s++) {
+      for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+        fprintf(stderr, "%-24s %5d %-6s ", traces[t], sizes[s], cache_policy_name(p));
+        cache_print_hit_rate_h(caches[s * CACHE_NUM_POLICIES + p]);
+        cache_close(caches[s * CACHE_NUM_POLICIES + p]);
+      }
+    }
+    free(ops);
+  }
+}
+
+/* Replays each trace through a fully associative LRU cache and through
+ * set-associative ones of the same size, one at a time so each gets its own
+ * timing. */
+void bench_assoc(char **traces, int num_traces) {
+  static const int sizes[] = { 64, 256, 1024, 4096 };
+  static const int ways[] = { 0, 2, 4, 8, 16 };
+
+  printf("%-24s %6s %5s %8s %14s\n", "trace", "size", "ways", "hit rate", "lookups/s");
+  for (int t = 0; t < num_traces; t++) {
+    trace_op_t *ops;
+    int num_ops = trace_load(traces[t], &ops);
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      for (int w = 0; w < sizeof(ways) / sizeof(ways[0]); w++) {
+        cache_options_t options = { .ways = ways[w] };
+        cache_t *cache = cache_open(sizes[s], &options);
+        cache_stats_t stats;
+        if (cache == NULL)
+          errx(1, "Failed to create cache.");
+
+        double start = bench_now();
+        replay_blocks(ops, num_ops, &cache, 1);
+        double elapsed = bench_now() - start;
+        cache_get_stats_h(cache, &stats);
+        cache_close(cache);
+
+        char label[8] = "full";
+        if (ways[w])
+          snprintf(label, sizeof(label), "%d", ways[w]);
+        printf("%-24s %6d %5s %7.1f%% %14.0f\n", traces[t], sizes[s], label,
+               100.0 * stats.hits / stats.queries, stats.queries / elapsed);
+      }
+    }
+    free(ops);
+  }
+}
+
+/* Fills every block with zeros, as JBOD starts out, so each replay sees the
+ * drives in the state the trace's expected output assumes. */
+static void wipe_drives(void) {
+  uint8_t zeros[MAX_IO_SIZE] = { 0 };
+
+  if (mdadm_mount() != 1)
+    errx(1, "Failed to mount.");
+  for (uint32_t addr = 0; addr < JBOD_NUM_DISKS * JBOD_DISK_SIZE; addr += MAX_IO_SIZE)
+    if (mdadm_write(addr, MAX_IO_SIZE, zeros) != MAX_IO_SIZE)
+      errx(1, "Failed to wipe the drives.");
+  mdadm_unmount();
+}
+
+/* Signs every block, as tester does on SIGNALL, with the signatures that
+ * JBOD prints on stdout sent to |fd| instead. */
+static void sign_blocks(int fd) {
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  dup2(fd, STDOUT_FILENO);
+  for (int i = 0; i < JBOD_NUM_DISKS; i++)
+    for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; j++)
+      jbod_sign_block(i, j);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+}
+
+/* Returns true if the files |a| and |b| hold the same lines, ignoring
+ * carriage returns (the expected outputs have CRLF line ends). */
+static bool same_lines(FILE *a, FILE *b) {
+  int ca, cb;
+
+  do {
+    while ((ca = getc(a)) == '\r')
+      ;
+    while ((cb = getc(b)) == '\r')
+      ;
+  } while (ca == cb && ca != EOF);
+  return ca == cb;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Replays |ops| once through mdadm with a cache of |cache_size| entries (none
+ * if 0), storing the latency of each READ and WRITE in |latencies| and
+ * returning their number. Only those calls are timed: the trace is parsed
+ * beforehand and SIGNALL signs into |sig_fd| (see sign_blocks) untimed. */
+static int replay_once(const trace_op_t *ops, int num_ops, int cache_size,
+                       uint64_t *latencies, int sig_fd) {
+  uint8_t buf[MAX_IO_SIZE];
+  int n = 0;
+
+  if (cache_size && cache_create(cache_size) != 1)
+    errx(1, "Failed to create cache.");
+  for (int i = 0; i < num_ops; i++) {
+    const trace_op_t *op = &ops[i];
+    int rc = 0;
+
+    switch (op->cmd) {
+      case TRACE_MOUNT:
+        rc = mdadm_mount();
+        break;
+      case TRACE_UNMOUNT:
+        rc = mdadm_unmount();
+        break;
+      case TRACE_SIGNALL:
+        if (cache_enabled() && cache_flush() != 1)
+          errx(1, "Failed to flush the cache before signing.");
+        sign_blocks(sig_fd);
+        break;
+      case TRACE_READ:
+      case TRACE_WRITE: {
+        if (op->cmd == TRACE_WRITE)
+          memset(buf, op->ch, op->len);
+        double start = bench_now();
+        if (op->cmd == TRACE_READ)
+          rc = mdadm_read(op->addr, op->len, buf);
+        else
+          rc = mdadm_write(op->addr, op->len, buf);
+        latencies[n++] = (bench_now() - start) * 1e9;
+        break;
+      }
+    }
+    if (rc == -1)
+      errx(1, "Replay failed on operation %d.", i);
+  }
+  if (cache_size)
+    cache_destroy();
+  return n;
+}
+
+/* Replays each trace |iterations| times per cache size and prints one row per
+ * trace and size: throughput of the timed calls, their median and 99th
+ * percentile latency, the JBOD cost and hit rate of a single replay, and
+ * whether the signatures matched the trace's expected output. */
+void bench_replay(char **traces, int num_traces, const int *sizes, int num_sizes,
+                  int iterations, bool json) {
+  if (json)
+    printf("[\n");
+  else
+    printf("trace,cache_size,iterations,ops,ops_per_sec,p50_ns,p99_ns,cost,hit_rate,output\n");
+
+  for (int t = 0; t < num_traces; t++) {
+    trace_op_t *ops;
+    int num_ops = trace_load(traces[t], &ops);
+
+    /* traces/x-input is checked against traces/x-expected-output. */
+    char expected_path[1024] = "";
+    const char *suffix = strstr(traces[t], "-input");
+    if (suffix != NULL && suffix[strlen("-input")] == '\0')
+      snprintf(expected_path, sizeof(expected_path), "%.*s-expected-output",
+               (int)(suffix - traces[t]), traces[t]);
+    FILE *expected = expected_path[0] ? fopen(expected_path, "r") : NULL;
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1)
+      err(1, "Cannot open /dev/null");
+
+    for (int s = 0; s < num_sizes; s++) {
+      uint64_t *latencies = malloc((size_t)iterations * num_ops * sizeof(uint64_t));
+      mdadm_stats_t stats;
+      const char *output = "n/a";
+      int n = 0;
+      double elapsed = 0;
+
+      for (int it = 0; it < iterations; it++) {
+        FILE *sigs = it == 0 && expected != NULL ? tmpfile() : NULL;
+        wipe_drives();
+        mdadm_stats_reset();
+        n += replay_once(ops, num_ops, sizes[s], latencies + n,
+                         sigs != NULL ? fileno(sigs) : null_fd);
+        if (it == 0)
+          mdadm_stats(&stats);
+        if (sigs != NULL) {
+          rewind(sigs);
+          rewind(expected);
+          output = same_lines(sigs, expected) ? "ok" : "diff";
+          fclose(sigs);
+        }
+      }
+      for (int i = 0; i < n; i++)
+        elapsed += latencies[i] / 1e9;
+      qsort(latencies, n, sizeof(uint64_t), compare_u64);
+      uint64_t p50 = n ? latencies[n / 2] : 0;
+      uint64_t p99 = n ? latencies[(uint64_t)n * 99 / 100] : 0;
+      double ops_per_sec = elapsed > 0 ? n / elapsed : 0;
+      char hit_rate[16] = "";
+      if (sizes[s] && stats.cache.queries)
+        snprintf(hit_rate, sizeof(hit_rate), "%.2f",
+                 100.0 * stats.cache.hits / stats.cache.queries);
+
+      if (json)
+        printf("  {\"trace\": \"%s\", \"cache_size\": %d, \"iterations\": %d, "
+               "\"ops\": %d, \"ops_per_sec\": %.0f, \"p50_ns\": %llu, "
+               "\"p99_ns\": %llu, \"cost\": %llu, \"hit_rate\": %s, "
+               "\"output\": \"%s\"}%s\n", traces[t], sizes[s], iterations,
+               n, ops_per_sec, (unsigned long long)p50, (unsigned long long)p99,
+               (unsigned long long)stats.total_cost, hit_rate[0] ? hit_rate : "null",
+               output, t == num_traces - 1 && s == num_sizes - 1 ? "" : ",");
+      else
+        printf("%s,%d,%d,%d,%.0f,%llu,%llu,%llu,%s,%s\n", traces[t], sizes[s],
+               iterations, n, ops_per_sec, (unsigned long long)p50,
+               (unsigned long long)p99, (unsigned long long)stats.total_cost,
+               hit_rate, output);
+      free(latencies);
+    }
+    if (expected != NULL)
+      fclose(expected);
+    close(null_fd);
+    free(ops);
+  }
+  if (json)
+    printf("]\n");
+}
+
+/* Adds |delta| at position |i| of the Fenwick tree |tree| of |n| counters. */
+static void fenwick_add(int *tree, int n, int i, int delta) {
+  for (i++; i <= n; i += i & -i)
+    tree[i - 1] += delta;
+}
+
+/* Returns the sum of the first |i| counters of |tree|. */
+static int fenwick_sum(const int *tree, int i) {
+  int sum = 0;
+  for (; i > 0; i -= i & -i)
+    sum += tree[i - 1];
+  return sum;
+}
+
+/* Returns true if SHARDS sampling at |rate| keeps |key|: a fixed, hashed
+ * subset of the blocks, so every reference to a kept block is seen. */
+static bool sampled(int key, double rate) {
+  return (((uint32_t)key * 2654435761u) >> 8) < rate * (1u << 24);
+}
+
+/* Computes the LRU stack distance of every block reference in each trace
+ * (Mattson et al.): the number of distinct blocks referenced since the last
+ * reference to the same block. A reference hits in an LRU cache of C blocks
+ * exactly when its distance is below C, so one pass gives the hit rate of
+ * every size. Blocks are referenced as replay_blocks does. The distances are
+ * counted with a Fenwick tree over reference times that marks the last
+ * reference of each block, so each reference costs O(log n).
+ *
+ * With |rate| below 1 only a |rate| fraction of the blocks is followed
+ * (SHARDS) and the distances are scaled by 1 / |rate|. */
+void bench_mrc(char **traces, int num_traces, const int *sizes, int num_sizes,
+               double rate) {
+  printf("trace,size,hit_rate\n");
+  for (int t = 0; t < num_traces; t++) {
+    trace_op_t *ops;
+    int num_ops = trace_load(traces[t], &ops);
+    int num_refs = 0;
+
+    for (int i = 0; i < num_ops; i++)
+      if ((ops[i].cmd == TRACE_READ || ops[i].cmd == TRACE_WRITE) && ops[i].len > 0)
+        num_refs += (ops[i].addr + ops[i].len - 1) / JBOD_BLOCK_SIZE -
+                    ops[i].addr / JBOD_BLOCK_SIZE + 1;
+
+    int *tree = calloc(num_refs + 1, sizeof(int));
+    uint64_t hist[NUM_KEYS + 1] = { 0 };  /* by distance, capped at NUM_KEYS */
+    int last[NUM_KEYS];
+    int now = 0;
+    for (int k = 0; k < NUM_KEYS; k++)
+      last[k] = -1;
+
+    for (int i = 0; i < num_ops; i++) {
+      if ((ops[i].cmd != TRACE_READ && ops[i].cmd != TRACE_WRITE) || ops[i].len == 0)
+        continue;
+      uint32_t first = ops[i].addr / JBOD_BLOCK_SIZE;
+      uint32_t end = (ops[i].addr + ops[i].len - 1) / JBOD_BLOCK_SIZE;
+      for (uint32_t b = first; b <= end; b++) {
+        if (!sampled(b, rate))
+          continue;
+        uint64_t distance = NUM_KEYS;  /* first reference: always a miss */
+        if (last[b] != -1) {
+          distance = (fenwick_sum(tree, now) - fenwick_sum(tree, last[b] + 1)) / rate;
+          fenwick_add(tree, num_refs, last[b], -1);
+        }
+        hist[distance < NUM_KEYS ? distance : NUM_KEYS]++;
+        fenwick_add(tree, num_refs, now, 1);
+        last[b] = now++;
+      }
+    }
+
+    /* hits[c] is the number of references with a distance below c. */
+    uint64_t *hits = calloc(NUM_KEYS + 1, sizeof(uint64_t));
+    for (int c = 1; c <= NUM_KEYS; c++)
+      hits[c] = hits[c - 1] + hist[c - 1];
+    for (int s = 0; s < (num_sizes ? num_sizes : NUM_KEYS - 1); s++) {
+      int size = num_sizes ? sizes[s] : s + 2;
+      printf("%s,%d,%.2f\n", traces[t], size, now ? 100.0 * hits[size] / now : 0);
+    }
+    free(hits);
+    free(tree);
+    free(ops);
+  }
+}
+
+/* Parses a comma-separated list of cache sizes into |sizes|, which has room
+ * for |max| of them. Returns how many there were, or -1 if one is invalid. */
+static int parse_sizes(const char *list, int *sizes, int max) {
+  int n = 0;
+  char *end;
+
+  for (const char *p = list; *p != '\0'; p = *end == ',' ? end + 1 : end) {
+    long size = strtol(p, &end, 10);
+    if (end == p || (*end != ',' && *end != '\0') || n == max ||
+        (size != 0 && (size < 2 || size > 4096)))
+      return -1;
+    sizes[n++] = size;
+  }
+  return n;
+}
+
+#define WARM_WINDOW 1000  /* cache lookups per hit-rate sample */
+
+/* Replays the reads and writes of |ops| through the mounted mdadm and
+ * stores the hit rate of each window of WARM_WINDOW cache lookups in
+ * |rates|. Returns the number of windows. */
+static int replay_windows(const trace_op_t *ops, int num_ops, double *rates) {
+  uint8_t buf[MAX_IO_SIZE];
+  cache_stats_t start, now;
+  int n = 0;
+
+  cache_get_stats(&start);
+  for (int i = 0; i < num_ops; i++) {
+    const trace_op_t *op = &ops[i];
+    int rc = 0;
+    if (op->cmd == TRACE_READ) {
+      rc = mdadm_read(op->addr, op->len, buf);
+    } else if (op->cmd == TRACE_WRITE) {
+      memset(buf, op->ch, op->len);
+      rc = mdadm_write(op->addr, op->len, buf);
+    }
+    if (rc == -1)
+      errx(1, "Replay failed on operation %d.", i);
+    cache_get_stats(&now);
+    if (now.queries - start.queries >= WARM_WINDOW) {
+      rates[n++] = (double)(now.hits - start.hits) / (now.queries - start.queries);
+      start = now;
+    }
+  }
+  return n;
+}
+
+void bench_warm(char **traces, int num_traces, const int *sizes, int num_sizes) {
+  printf("trace,cache_size,start,loaded,first_window,windows_to_steady,"
+         "hit_rate,cost\n");
+
+  for (int t = 0; t < num_traces; t++) {
+    trace_op_t *ops;
+    int num_ops = trace_load(traces[t], &ops);
+    double *rates[2] = { malloc(num_ops * sizeof(double)),
+                         malloc(num_ops * sizeof(double)) };
+    char path[] = "/tmp/bench-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+      err(1, "Cannot create a snapshot file");
+    close(fd);
+
+    for (int s = 0; s < num_sizes; s++) {
+      if (sizes[s] == 0)
+        continue;
+      /* The run before the restart, which leaves its cache in |path|. The
+       * warm run goes next, while JBOD still holds what was saved. */
+      wipe_drives();
+      if (cache_create(sizes[s]) != 1 || mdadm_mount() != 1)
+        errx(1, "Failed to create cache.");
+      replay_windows(ops, num_ops, rates[0]);
+      mdadm_unmount();
+      if (cache_save(path) != 1)
+        errx(1, "Failed to save the cache to %s.", path);
+      cache_destroy();
+
+      /* A restarted system does not load its data again, so the runs after
+       * the restart skip the writes that open the trace. */
+      int first = 0;
+      while (first < num_ops && ops[first].cmd != TRACE_READ)
+        first++;
+      int windows[2], loaded[2] = { 0, 0 };
+      uint64_t cost[2];
+      double hit_rate[2];
+      for (int warm = 1; warm >= 0; warm--) {
+        cache_stats_t stats;
+        mdadm_stats_t mstats;
+        if (cache_create(sizes[s]) != 1 || mdadm_mount() != 1)
+          errx(1, "Failed to create cache.");
+        mdadm_stats_reset();
+        if (warm && (loaded[warm] = cache_load(path)) == -1)
+          errx(1, "Failed to load the cache from %s.", path);
+        windows[warm] = replay_windows(ops + first, num_ops - first, rates[warm]);
+        mdadm_unmount();
+        mdadm_stats(&mstats);
+        cache_get_stats(&stats);
+        cost[warm] = mstats.total_cost;
+        hit_rate[warm] = stats.queries ? 100.0 * stats.hits / stats.queries : 0;
+        cache_destroy();
+      }
+
+      /* Steady state is the hit rate over the second half of the cold run;
+       * a run has reached it at the first window within 10% of it. */
+      double steady = 0;
+      for (int w = windows[0] / 2; w < windows[0]; w++)
+        steady += rates[0][w] / (windows[0] - windows[0] / 2);
+      for (int warm = 1; warm >= 0; warm--) {
+        int w = 0;
+        while (w < windows[warm] && rates[warm][w] < 0.9 * steady)
+          w++;
+        /* Left empty when the trace has too few lookups for a window. */
+        char first_window[16] = "", to_steady[16] = "";
+        if (windows[0] > 0 && windows[warm] > 0) {
+          snprintf(first_window, sizeof(first_window), "%.2f", 100 * rates[warm][0]);
+          snprintf(to_steady, sizeof(to_steady), "%d", w + 1);
+        }
+        printf("%s,%d,%s,%d,%s,%s,%.2f,%llu\n", traces[t], sizes[s],
+               warm ? "snapshot" : "cold", loaded[warm], first_window, to_steady,
+               hit_rate[warm], (unsigned long long)cost[warm]);
+      }
+    }
+    remove(path);
+    free(rates[0]);
+    free(rates[1]);
+    free(ops);
+  }
+}
+
+/* Returns the |field| of /proc/self/smaps_rollup in kB, or -1 where it is
+ * not available. */
+static long rollup_kb(const char *field) {
+  char line[128];
+  long kb = -1;
+  size_t n = strlen(field);
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+
+  if (f == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (strncmp(line, field, n) == 0 && line[n] == ':')
+      kb = atol(line + n + 1);
+  fclose(f);
+  return kb;
+}
+
+void bench_open(void) {
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+
+  printf("%8s %12s %12s %12s %14s %14s\n", "entries", "open+close us",
+         "fill us", "lookup ns", "resident kB", "hugepage kB");
+  for (int size = 64; size <= 4096; size *= 2) {
+    int opens = 2000;
+    double start = bench_now();
+    for (int i = 0; i < opens; i++) {
+      if (cache_create(size) != 1)
+        errx(1, "Failed to create cache of %d entries.", size);
+      cache_destroy();
+    }
+    double open_us = (bench_now() - start) / opens * 1e6;
+
+    /* What filling the cache adds to the process, and how fast it goes. */
+    long rss = rollup_kb("Rss"), huge = rollup_kb("AnonHugePages");
+    cache_create(size);
+    start = bench_now();
+    for (int i = 0; i < size; i++)
+      cache_insert(i / JBOD_NUM_BLOCKS_PER_DISK, i % JBOD_NUM_BLOCKS_PER_DISK, buf);
+    double fill_us = (bench_now() - start) * 1e6;
+    rss = rollup_kb("Rss") - rss;
+    huge = rollup_kb("AnonHugePages") - huge;
+
+    /* Hits on random slots, each copying a block out of the arena. */
+    int hits = 0;
+    start = bench_now();
+    for (int i = 0; i < LOOKUP_QUERIES; i++) {
+      int k = bench_rand() % size;
+      hits += cache_lookup(k / JBOD_NUM_BLOCKS_PER_DISK,
+                           k % JBOD_NUM_BLOCKS_PER_DISK, buf) == 1;
+    }
+    double lookup_ns = (bench_now() - start) / LOOKUP_QUERIES * 1e9;
+    if (hits != LOOKUP_QUERIES)
+      errx(1, "Open benchmark missed a cached block.");
+    cache_destroy();
+
+    printf("%8d %12.2f %12.1f %12.1f %14ld %14ld\n", size, open_us, fill_us,
+           lookup_ns, rss, huge);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int ch, iterations = 5;
+  const char *mode = "lookup";
+  int sizes[16] = { 0, 64, 1024, 4096 }, num_sizes = 4;
+  bool sizes_given = false, json = false;
+  double rate = 1;
+
+  while ((ch = getopt(argc, argv, BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'm':
+        mode = optarg;
+        break;
+      case 'i':
+        iterations = atoi(optarg);
+        if (iterations < 1)
+          errx(1, "Invalid number of iterations (%s), aborting.", optarg);
+        break;
+      case 's':
+        num_sizes = parse_sizes(optarg, sizes, sizeof(sizes) / sizeof(sizes[0]));
+        if (num_sizes < 1)
+          errx(1, "Invalid cache sizes (%s), aborting.", optarg);
+        sizes_given = true;
+        break;
+      case 'R':
+        rate = atof(optarg);
+        if (rate <= 0 || rate > 1)
+          errx(1, "Invalid sampling rate (%s), aborting.", optarg);
+        break;
+      case 'f':
+        if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0)
+          errx(1, "Unknown output format (%s), aborting.", optarg);
+        json = strcmp(optarg, "json") == 0;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  char **traces = argv + optind;
+  int num_traces = argc - optind;
+  if (num_traces == 0) {
+    traces = default_traces;
+    num_traces = NUM_DEFAULT_TRACES;
+  }
+
+  if (strcmp(mode, "lookup") == 0)
+    bench_lookup();
+  else if (strcmp(mode, "policy") == 0)
+    bench_policy(traces, num_traces);
+  else if (strcmp(mode, "layout") == 0)
+    bench_layout();
+  else if (strcmp(mode, "keysearch") == 0)
+    bench_keysearch();
+  else if (strcmp(mode, "assoc") == 0)
+    bench_assoc(traces, num_traces);
+  else if (strcmp(mode, "replay") == 0)
+    bench_replay(traces, num_traces, sizes, num_sizes, iterations, json);
+  else if (strcmp(mode, "mrc") == 0)
+    bench_mrc(traces, num_traces, sizes, sizes_given ? num_sizes : 0, rate);
+  else if (strcmp(mode, "open") == 0)
+    bench_open();
+  else if (strcmp(mode, "warm") == 0)
+    bench_warm(traces, num_traces, sizes_given ? sizes : (int[]){ 1024 },
+               sizes_given ? num_sizes : 1);
+  else
+    errx(1, "Unknown benchmark mode [%s], aborting.", mode);
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  TRACE_MOUNT,
+  TRACE_UNMOUNT,
+  TRACE_SIGNALL,
+  TRACE_READ,
+  TRACE_WRITE,
+} trace_cmd_t;
+
+/* One parsed line of a workload in the traces/ input format. */
+typedef struct {
+  trace_cmd_t cmd;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t ch;
+} trace_op_t;
+
+/* Parses the workload file at |path| into a malloc'd array stored in |ops|.
+ * Returns the number of operations; exits on malformed input. */
+int trace_load(const char *path, trace_op_t **ops);
+
+/* Returns a monotonic timestamp in seconds. */
+double bench_now(void);
+
+/* Microbenchmark: cache_lookup throughput against cache size, next to the
+ * linear scan it replaced. */
+void bench_lookup(void);
+
+/* Microbenchmark: linear-scan lookups over entries with inline blocks versus
+ * packed keys with a separate payload slab, plus indexed cache_lookup, with
+ * L1D and LLC misses per lookup where perf counters are available. */
+void bench_layout(void);
+
+/* Microbenchmark: hit and miss probes of keysearch_find over 8 to 64 keys,
+ * for every implementation the CPU supports. */
+void bench_keysearch(void);
+
+/* Replays the block references of each trace in |traces| against every
+ * eviction policy and prints the resulting hit rates. */
+void bench_policy(char **traces, int num_traces);
+
+/* Hit rate and lookup throughput of fully associative LRU versus 2- to
+ * 16-way set-associative caches of the same size, for each trace. */
+void bench_assoc(char **traces, int num_traces);
+
+/* Replays each trace through mdadm |iterations| times for each of the
+ * |num_sizes| cache sizes in |sizes| (0 for no cache), timing every read and
+ * write, and prints throughput, p50/p99 latency, JBOD cost, hit rate and
+ * whether the output matched traces/<name>-expected-output, as CSV or, with
+ * |json|, as a JSON array. */
+void bench_replay(char **traces, int num_traces, const int *sizes, int num_sizes,
+                  int iterations, bool json);
+
+/* Prints the LRU hit rate of each trace for each of the |num_sizes| cache
+ * sizes in |sizes|, or for every size from 2 to 4096 if |num_sizes| is 0,
+ * computed in one pass from stack distances. With |rate| below 1 only that
+ * fraction of the blocks is sampled. */
+void bench_mrc(char **traces, int num_traces, const int *sizes, int num_sizes,
+               double rate);
+
+/* Microbenchmark: time to open and close an empty cache, to fill it, and
+ * to hit it, against cache size, with the memory filling it adds to the
+ * process and how much of that is hugepages. */
+void bench_open(void);
+
+/* Time to a steady hit rate after a restart: for each of the |num_sizes|
+ * cache sizes in |sizes|, replays each trace once, saves the cache with
+ * cache_save, then replays it again, from its first read on, from the
+ * snapshot and from a cold cache, and prints how many windows of 1000
+ * lookups each start takes to come within 10% of the steady hit rate, with
+ * the hit rate and JBOD cost. */
+void bench_warm(char **traces, int num_traces, const int *sizes, int num_sizes);
+
+#endif
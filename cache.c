@@ -1,98 +1,1094 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cache.h"
 
-static cache_entry_t *cache = NULL;
-static int cache_size = 0;
-static int clock = 0;
-static int num_queries = 0;
-static int num_hits = 0;
+#include "cache_policy.h"
+#include "keysearch.h"
+#include "slab.h"
+#include "tinylfu.h"
+
+#define CACHE_MAX_SHARDS 64
+
+/* Key of an empty slot in set-associative mode; no block has it. */
+#define CACHE_NO_KEY 0xffff
+
+/* Per-slot state other than the key and the data. */
+typedef struct {
+  uint16_t pins;  /* outstanding cache_get references; pinned slots stay */
+  bool dirty;     /* write-back mode: newer than the copy in JBOD */
+  uint32_t used;  /* set-associative mode: shard clock at the last use */
+} cache_meta_t;
+
+/* Ghost mode: the recency list of an LRU cache of |capacity| blocks, keys
+ * only, linked through arrays indexed by key. */
+typedef struct {
+  int capacity;
+  int count;
+  int16_t head, tail;  /* most and least recently used, -1 when empty */
+  int16_t prev[CACHE_NUM_KEYS];
+  int16_t next[CACHE_NUM_KEYS];
+  bool present[CACHE_NUM_KEYS];
+} ghost_lru_t;
+
+/* The cache is split into shards by block key. Each shard is a complete small
+ * cache with its own lock, entries, index, policy and counters, so threads
+ * working on blocks in different shards never contend. Shards are cache-line
+ * aligned so two locks never share a line.
+ *
+ * Slots are stored as a structure of arrays: the packed block keys, the rest
+ * of the metadata and the block payloads each live in their own 64-byte
+ * aligned array, so walking keys or metadata never drags 256-byte blocks
+ * through the CPU cache. The payloads of all shards share one arena (see
+ * slab.h), which the kernel backs only as slots get filled; a filling shard
+ * hands out slots in order, so the backed part grows from the front.
+ *
+ * A fully associative shard finds blocks through |index| and leaves the
+ * order of its slots to the eviction policy. A set-associative shard splits
+ * its slots into sets of |ways| consecutive slots; a block can only live in
+ * the set its key hashes to, which is searched with keysearch_find, and the
+ * least recently used slot of the set is evicted. */
+typedef struct {
+  pthread_mutex_t lock;
+  uint16_t *keys;       /* block key (see cache_key) held by each slot */
+  cache_meta_t *meta;
+  uint8_t *slab;        /* JBOD_BLOCK_SIZE bytes per slot, in the arena */
+  int size;
+  int used;
+  int ways;             /* 0 when fully associative */
+  int num_sets;
+  uint32_t clock;
+  const struct cache_policy_ops *policy_ops;
+  void *policy_state;
+  cache_stats_t stats;
+  ghost_lru_t *ghosts;  /* ghost mode: half and twice the shard size */
+  tinylfu_t *admission; /* admission filter for cache_insert, or NULL */
+  /* Direct-mapped table from block key to slot + 1 (0 = not cached). */
+  int16_t index[CACHE_NUM_KEYS];
+} __attribute__((aligned(64))) cache_shard_t;
+
+struct cache {
+  cache_shard_t *shards;
+  slab_t *arena;  /* the payloads of every shard, one after the other */
+  int num_shards;
+  int size;
+  bool write_back;
+  cache_writeback_fn writeback_fn;
+  cache_stamp_fn stamp_fn;
+  cache_options_t options;  /* as opened, for cache_resize */
+};
+
+/* The instance behind the cache_* functions that take no handle. */
+static cache_t *default_cache = NULL;
+static cache_writeback_fn default_writeback_fn = NULL;
+static cache_stamp_fn default_stamp_fn = NULL;
+/* Counters of the last default cache, kept by cache_destroy so the hit rate
+ * of a run can still be printed after it. */
+static cache_stats_t last_stats;
 int create_count = 0;
 
+static inline bool valid_key(int disk_num, int block_num) {
+  return disk_num >= 0 && disk_num < JBOD_NUM_DISKS &&
+         block_num >= 0 && block_num < JBOD_NUM_BLOCKS_PER_DISK;
+}
 
-/*
-GRADER NOTE: If youre reading this, then youll see that i have a large portion of my code commented out.
-            this is because i figured out i passed 6 tests at this point for some reason earlier on when
-            running my makefile. i have no idea how this happened, but i remembered just in case i didnt finish,
-            and since i had a lot of trouble with my VM once again when relocating back to NJ, i lost my ability
-            to work for the last few days. I was passing some tests with my code, just not 6 of them. it was 2 or
-            even 4 at one point, but not 6. Hopefully that clever rework gets me points at least
-*/
+static inline int cache_key(int disk_num, int block_num) {
+  return disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num;
+}
 
+/* Returns the shard of |c| responsible for |key|. The multiplicative hash
+ * spreads neighbouring blocks, which sequential workloads touch together,
+ * across shards. */
+static cache_shard_t *shard_of(cache_t *c, int key) {
+  if (c->num_shards == 1)
+    return &c->shards[0];
+  return &c->shards[((uint32_t)key * 2654435761u >> 16) % c->num_shards];
+}
 
+static cache_shard_t *lock_shard(cache_t *c, int key) {
+  cache_shard_t *shard = shard_of(c, key);
+  pthread_mutex_lock(&shard->lock);
+  return shard;
+}
 
+static void unlock_shard(cache_shard_t *shard) {
+  pthread_mutex_unlock(&shard->lock);
+}
 
-int cache_create(int num_entries) {
-  if(create_count == 1){ return -1; } // cache_create cannot be ran twice
-
-  if (2 <= num_entries && num_entries <= 4096){
-    cache = calloc(num_entries, sizeof(cache_entry_t)); 
-    cache_size = num_entries;         
-    create_count++;
-  }                                   // should fail if it doesn't fit in the min/max required by the README
-  else{ return -1; }                                   
-return 1;
-} // END CACHE CREATE -- PASSED ALL TESTS
-
-
-int cache_destroy(void) { 
-  if (create_count == 0){ return -1; }
-  free(cache);                        // #freeMyBoiCache
-  cache = NULL;                       
-  cache_size = 0;                     
-  create_count = 0;                   
+/* Returns the first slot of the set |key| maps to. The hash differs from
+ * the one in shard_of, so the keys of a shard still spread over its sets. */
+static int set_of(cache_shard_t *shard, int key) {
+  return ((uint32_t)key * 2246822519u >> 16) % shard->num_sets * shard->ways;
+}
+
+/* Returns the slot caching |key| in |shard|, or -1 on a miss. */
+static int find_slot(cache_shard_t *shard, int key) {
+  if (shard->ways == 0)
+    return shard->index[key] - 1;
+  int set = set_of(shard, key);
+  int way = keysearch_find(&shard->keys[set], shard->ways, key);
+  return way == -1 ? -1 : set + way;
+}
+
+/* Marks |slot| as accessed. */
+static void touch(cache_shard_t *shard, int slot) {
+  if (shard->ways == 0)
+    shard->policy_ops->touch(shard->policy_state, slot);
+  else
+    shard->meta[slot].used = ++shard->clock;
+}
+
+static void ghost_unlink(ghost_lru_t *g, int key) {
+  if (g->prev[key] != -1)
+    g->next[g->prev[key]] = g->next[key];
+  else
+    g->head = g->next[key];
+  if (g->next[key] != -1)
+    g->prev[g->next[key]] = g->prev[key];
+  else
+    g->tail = g->prev[key];
+}
+
+/* Makes |key| the most recently used block of |g|, evicting the least
+ * recently used one if |g| overflows. Returns true if |key| was in |g|. */
+static bool ghost_access(ghost_lru_t *g, int key) {
+  bool present = g->present[key];
+
+  if (present) {
+    ghost_unlink(g, key);
+  } else if (g->count == g->capacity) {
+    g->present[g->tail] = false;
+    ghost_unlink(g, g->tail);
+  } else {
+    g->count++;
+  }
+  g->present[key] = true;
+  g->prev[key] = -1;
+  g->next[key] = g->head;
+  if (g->head != -1)
+    g->prev[g->head] = key;
+  g->head = key;
+  if (g->tail == -1)
+    g->tail = key;
+  return present;
+}
+
+/* Records a use of |key| in the ghost lists of |shard|, if it has them,
+ * counting their hits if the use is a lookup. */
+static void ghost_use(cache_shard_t *shard, int key, bool lookup) {
+  if (shard->ghosts == NULL)
+    return;
+  if (ghost_access(&shard->ghosts[0], key) && lookup)
+    shard->stats.half_size_hits++;
+  if (ghost_access(&shard->ghosts[1], key) && lookup)
+    shard->stats.double_size_hits++;
+}
+
+/* Records a use of |key| in the admission filter of |shard|, if any. Each
+ * reference counts once: a lookup that hits, or the insert that follows a
+ * miss, plus every update and write. */
+static void admission_record(cache_shard_t *shard, int key) {
+  if (shard->admission != NULL)
+    tinylfu_record(shard->admission, key);
+}
+
+/* Returns true if |key| may replace |victim_key| in |shard|, counting a
+ * rejection otherwise. */
+static bool admit(cache_shard_t *shard, int key, int victim_key) {
+  if (shard->admission == NULL || tinylfu_admit(shard->admission, key, victim_key))
+    return true;
+  shard->stats.rejections++;
+  return false;
+}
+
+static uint8_t *slot_block(cache_shard_t *shard, int slot) {
+  return shard->slab + (size_t)slot * JBOD_BLOCK_SIZE;
+}
+
+/* Writes the dirty block in |slot| back and marks it clean. */
+static int clean(cache_t *c, cache_shard_t *shard, int slot) {
+  int key = shard->keys[slot];
+
+  if (c->writeback_fn == NULL)
+    return -1;
+  if (c->writeback_fn(key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK,
+                      slot_block(shard, slot)) != 1)
+    return -1;
+  shard->meta[slot].dirty = false;
+  shard->stats.write_backs++;
   return 1;
-}// END CACHE_DESTROY -- PASSED ALL TESTS
+}
+
+static bool slot_pinned(void *ctx, int slot) {
+  cache_shard_t *shard = ctx;
+  return shard->meta[slot].pins > 0;
+}
+
+/* alloc_slot for a set-associative shard: an empty way of the set of |key|
+ * if there is one, otherwise its least recently used unpinned way. */
+static int alloc_way(cache_t *c, cache_shard_t *shard, int key, bool filtered) {
+  int set = set_of(shard, key);
+  int victim = keysearch_find(&shard->keys[set], shard->ways, CACHE_NO_KEY);
+
+  if (victim != -1)
+    return set + victim;
+  for (int slot = set; slot < set + shard->ways; slot++) {
+    if (shard->meta[slot].pins > 0)
+      continue;
+    if (victim == -1 || shard->meta[slot].used - shard->meta[victim].used > INT32_MAX)
+      victim = slot;  /* older, allowing for the clock wrapping around */
+  }
+  if (victim == -1)
+    return -1;
+  if (filtered && !admit(shard, key, shard->keys[victim]))
+    return -1;
+  if (shard->meta[victim].dirty && clean(c, shard, victim) == -1)
+    return -1;
+  shard->keys[victim] = CACHE_NO_KEY;
+  shard->stats.evictions++;
+  return victim;
+}
+
+/* Picks the slot for |key|: the next unused one while the shard is filling
+ * up, otherwise the victim chosen by the policy, which gets unindexed after
+ * its data is written back if dirty. With |filtered|, the admission filter
+ * may keep the victim instead. Returns -1 if every entry is pinned, the
+ * block is not admitted or the write-back fails; a victim that stays is
+ * restored to the policy as it was. */
+static int alloc_slot(cache_t *c, cache_shard_t *shard, int key, bool filtered) {
+  if (shard->ways != 0)
+    return alloc_way(c, shard, key, filtered);
+  if (shard->used < shard->size)
+    return shard->used++;
 
+  int victim = shard->policy_ops->evict(shard->policy_state, key, slot_pinned, shard);
+  if (victim == -1)
+    return -1;
+  int victim_key = shard->keys[victim];
+  if ((filtered && !admit(shard, key, victim_key)) ||
+      (shard->meta[victim].dirty && clean(c, shard, victim) == -1)) {
+    shard->policy_ops->restore(shard->policy_state, victim);
+    return -1;
+  }
+  shard->index[victim_key] = 0;
+  shard->stats.evictions++;
+  return victim;
+}
+
+/* Fills a freshly allocated |slot| with the block for |key|. */
+static void fill_slot(cache_shard_t *shard, int slot, int key,
+                      const uint8_t *buf, bool dirty) {
+  shard->keys[slot] = key;
+  shard->meta[slot] = (cache_meta_t){ .pins = 0, .dirty = dirty };
+  memcpy(slot_block(shard, slot), buf, JBOD_BLOCK_SIZE);
+  shard->stats.inserts++;
+  if (shard->ways != 0) {
+    touch(shard, slot);
+    return;
+  }
+  shard->policy_ops->insert(shard->policy_state, slot, key);
+  shard->index[key] = slot + 1;
+}
+
+/* Returns |n| zeroed bytes aligned to a cache line, or NULL. */
+static void *alloc_aligned(size_t n) {
+  n = (n + 63) & ~(size_t)63;
+  void *p = aligned_alloc(64, n);
+  if (p != NULL)
+    memset(p, 0, n);
+  return p;
+}
 
-int cache_lookup(int disk_num, int block_num, uint8_t *buf) { 
-  if (buf == NULL){ return -1;}       
-  if (create_count == 0){return -1;}  
-  if (disk_num == 0 && block_num == 0) {return -1;}     
+/* Releases the first |n| shards of |c| and |c| itself. */
+static void free_cache(cache_t *c, int n) {
+  for (int i = 0; i < n; i++) {
+    if (c->shards[i].policy_state != NULL)
+      c->shards[i].policy_ops->destroy(c->shards[i].policy_state);
+    free(c->shards[i].keys);
+    free(c->shards[i].meta);
+    free(c->shards[i].ghosts);
+    tinylfu_destroy(c->shards[i].admission);
+    pthread_mutex_destroy(&c->shards[i].lock);
+  }
+  free(c->shards);
+  slab_destroy(c->arena);
+  free(c);
+}
+
+cache_t *cache_open(int num_entries, const cache_options_t *options) {
+  // should fail if it doesn't fit in the min/max required by the README
+  if (num_entries < 2 || num_entries > 4096) { return NULL; }
+
+  const struct cache_policy_ops *ops =
+      cache_policy_lookup(options ? options->policy : CACHE_POLICY_LRU);
+  if (ops == NULL) { return NULL; }
 
-  for (int i = 0; i < cache_size; i++){
-    num_queries++;                   
-    if (disk_num == cache[i].disk_num && block_num == cache[i].block_num){ 
-      memcpy(buf, cache[i].block, sizeof(cache[i].block)); 
-      num_hits++;                     
-      clock++;                        
-      cache[i].access_time = clock;   // assign the acces time of entry to indicate recent use
+  int n = options && options->shards > 1 ? options->shards : 1;
+  if (n > CACHE_MAX_SHARDS || n > num_entries) { return NULL; }
+
+  int ways = options ? options->ways : 0;
+  if (ways < 0 || ways > num_entries / n) { return NULL; }
+  if (ways != 0 && options->policy != CACHE_POLICY_LRU) { return NULL; }
+
+  cache_t *c = calloc(1, sizeof(cache_t));
+  if (c == NULL) { return NULL; }
+  c->shards = aligned_alloc(64, n * sizeof(cache_shard_t));
+  if (c->shards == NULL) {
+    free(c);
+    return NULL;
+  }
+  memset(c->shards, 0, n * sizeof(cache_shard_t));
+  c->arena = slab_create((size_t)num_entries * JBOD_BLOCK_SIZE);
+  if (c->arena == NULL) {
+    free_cache(c, 0);
+    return NULL;
+  }
+  uint8_t *payloads = slab_base(c->arena);
+  for (int i = 0; i < n; i++) {
+    cache_shard_t *shard = &c->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->size = num_entries / n + (i < num_entries % n);
+    if (ways != 0) {
+      shard->ways = ways;
+      shard->num_sets = shard->size / ways;
+      shard->size = shard->num_sets * ways;
+    }
+    shard->policy_ops = ops;
+    shard->keys = alloc_aligned(shard->size * sizeof(uint16_t));
+    shard->meta = alloc_aligned(shard->size * sizeof(cache_meta_t));
+    shard->slab = payloads;
+    payloads += (size_t)shard->size * JBOD_BLOCK_SIZE;
+    bool ok = shard->keys != NULL && shard->meta != NULL;
+    if (ok && ways == 0)
+      ok = (shard->policy_state = ops->create(shard->size)) != NULL;
+    if (!ok) {
+      free_cache(c, i + 1);
+      return NULL;
+    }
+    if (ways != 0)
+      memset(shard->keys, 0xff, shard->size * sizeof(uint16_t));
+    if (options && options->admission &&
+        (shard->admission = tinylfu_create(shard->size)) == NULL) {
+      free_cache(c, i + 1);
+      return NULL;
+    }
+    if (options && options->ghost) {
+      shard->ghosts = malloc(2 * sizeof(ghost_lru_t));
+      if (shard->ghosts == NULL) {
+        free_cache(c, i + 1);
+        return NULL;
+      }
+      for (int g = 0; g < 2; g++) {
+        int capacity = g == 0 ? shard->size / 2 : shard->size * 2;
+        shard->ghosts[g] = (ghost_lru_t){ .head = -1, .tail = -1 };
+        shard->ghosts[g].capacity = capacity < 1 ? 1 : capacity;
+      }
     }
   }
-  return -1;
-} // END CACHE_LOOKUP -- PASSED ALL TESTS
+  c->num_shards = n;
+  c->size = num_entries;
+  c->write_back = options ? options->write_back : false;
+  c->options = options ? *options : (cache_options_t){ .policy = CACHE_POLICY_LRU };
+  return c;
+}
 
-int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
-  if (create_count == 0){return -1;}                    
-  if (buf == NULL){ return -1;}                      
-  if (disk_num < 0 || disk_num > 15) {return -1;}        
-  if (block_num < 0 || block_num > 15) {return -1;}     
- 
-  for (int i = 0; i < cache_size; i++){
-  if ( (cache[i].disk_num == 0) && (cache[i].block_num == 0) ) {
-    cache[i].disk_num = disk_num;
-    cache[i].block_num = block_num;
-    memcpy(cache[i].block, buf, 256);
-    clock++;                                  
-    cache[i].access_time = clock;           
+void cache_close(cache_t *c) {
+  if (c == NULL) { return; }
+  if (c->write_back && c->writeback_fn != NULL)
+    cache_flush_h(c);                 // don't lose writes absorbed by the cache
+  free_cache(c, c->num_shards);
+}
+
+int cache_lookup_h(cache_t *c, int disk_num, int block_num, uint8_t *buf) {
+  if (c == NULL || buf == NULL) { return -1; }
+  if (!valid_key(disk_num, block_num)) { return -1; }
+
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = lock_shard(c, key);
+  shard->stats.queries++;
+  ghost_use(shard, key, true);
+  int slot = find_slot(shard, key);
+  if (slot != -1) {
+    memcpy(buf, slot_block(shard, slot), JBOD_BLOCK_SIZE);
+    shard->stats.hits++;
+    admission_record(shard, key);
+    touch(shard, slot);
+  }
+  unlock_shard(shard);
+  return slot != -1 ? 1 : -1;
+}
+
+const uint8_t *cache_get_h(cache_t *c, int disk_num, int block_num) {
+  if (c == NULL || !valid_key(disk_num, block_num)) { return NULL; }
+
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = lock_shard(c, key);
+  shard->stats.queries++;
+  ghost_use(shard, key, true);
+  int slot = find_slot(shard, key);
+  if (slot != -1) {
+    shard->stats.hits++;
+    admission_record(shard, key);
+    shard->meta[slot].pins++;
+    touch(shard, slot);
+  }
+  unlock_shard(shard);
+  // the pin keeps the slot from being reused once the lock is dropped
+  return slot != -1 ? slot_block(shard, slot) : NULL;
+}
+
+void cache_put_h(cache_t *c, int disk_num, int block_num) {
+  if (c == NULL || !valid_key(disk_num, block_num)) { return; }
+
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = lock_shard(c, key);
+  int slot = find_slot(shard, key);
+  if (slot != -1 && shard->meta[slot].pins > 0)
+    shard->meta[slot].pins--;
+  unlock_shard(shard);
+}
+
+int cache_insert_h(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (c == NULL || buf == NULL) { return -1; }
+  if (!valid_key(disk_num, block_num)) { return -1; }
+
+  int key = cache_key(disk_num, block_num);
+  int slot = -1;
+  cache_shard_t *shard = lock_shard(c, key);
+  if (find_slot(shard, key) == -1) {
+    admission_record(shard, key);
+    slot = alloc_slot(c, shard, key, true);
+  }
+  if (slot != -1) {
+    fill_slot(shard, slot, key, buf, false);
+    ghost_use(shard, key, false);
+  }
+  unlock_shard(shard);
+  return slot != -1 ? 1 : -1;
+}
+
+void cache_update_h(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (c == NULL || buf == NULL) { return; }
+  if (!valid_key(disk_num, block_num)) { return; }
+
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = lock_shard(c, key);
+  int slot = find_slot(shard, key);
+  if (slot != -1) {
+    memcpy(slot_block(shard, slot), buf, JBOD_BLOCK_SIZE);
+    touch(shard, slot);
+    ghost_use(shard, key, false);
+    admission_record(shard, key);
+  }
+  unlock_shard(shard);
+}
+
+int cache_write_h(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+  if (c == NULL || !c->write_back) { return -1; }
+  if (buf == NULL) { return -1; }
+  if (!valid_key(disk_num, block_num)) { return -1; }
+
+  int key = cache_key(disk_num, block_num);
+  int rc = 1;
+  cache_shard_t *shard = lock_shard(c, key);
+  ghost_use(shard, key, false);
+  admission_record(shard, key);
+  int slot = find_slot(shard, key);
+  if (slot != -1) {
+    memcpy(slot_block(shard, slot), buf, JBOD_BLOCK_SIZE);
+    shard->meta[slot].dirty = true;
+    touch(shard, slot);
+  } else {
+    slot = alloc_slot(c, shard, key, false);
+    if (slot != -1)
+      fill_slot(shard, slot, key, buf, true);
+    else
+      rc = -1;
+  }
+  unlock_shard(shard);
+  return rc;
+}
+
+int cache_flush_h(cache_t *c) {
+  if (c == NULL) { return -1; }
+
+  /* Takes every shard lock, always in shard order, so the walk sees a stable
+   * cache. Walking keys in order writes blocks sorted by (disk, block). */
+  for (int i = 0; i < c->num_shards; i++)
+    pthread_mutex_lock(&c->shards[i].lock);
+
+  int rc = 1;
+  for (int key = 0; key < CACHE_NUM_KEYS && rc == 1; key++) {
+    cache_shard_t *shard = shard_of(c, key);
+    int slot = find_slot(shard, key);
+    if (slot != -1 && shard->meta[slot].dirty)
+      rc = clean(c, shard, slot);
+  }
+
+  for (int i = c->num_shards - 1; i >= 0; i--)
+    pthread_mutex_unlock(&c->shards[i].lock);
+  return rc;
+}
+
+/* Shrinks or grows |g| to hold |capacity| keys, forgetting the least
+ * recently used ones that no longer fit. */
+static void ghost_resize(ghost_lru_t *g, int capacity) {
+  g->capacity = capacity < 1 ? 1 : capacity;
+  for (; g->count > g->capacity; g->count--) {
+    g->present[g->tail] = false;
+    ghost_unlink(g, g->tail);
+  }
+}
+
+/* A slot of a set-associative shard and how long ago it was used. */
+typedef struct {
+  uint32_t age;
+  int slot;
+} slot_age_t;
+
+static int by_age_desc(const void *a, const void *b) {
+  uint32_t x = ((const slot_age_t *)a)->age, y = ((const slot_age_t *)b)->age;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Stores the slots of |shard| that hold a block in |slots|, coldest first,
+ * and returns how many there are. */
+static int slots_by_recency(cache_shard_t *shard, int *slots) {
+  if (shard->ways == 0)
+    return shard->policy_ops->order(shard->policy_state, slots);
+
+  slot_age_t *ages = malloc(shard->size * sizeof(slot_age_t));
+  if (ages == NULL)
+    return -1;
+  int n = 0;
+  for (int slot = 0; slot < shard->size; slot++)
+    if (shard->keys[slot] != CACHE_NO_KEY)
+      ages[n++] = (slot_age_t){ shard->clock - shard->meta[slot].used, slot };
+  qsort(ages, n, sizeof(slot_age_t), by_age_desc);
+  for (int i = 0; i < n; i++)
+    slots[i] = ages[i].slot;
+  free(ages);
+  return n;
+}
+
+/* Copies the blocks of |from| into the empty shard |to| of |next|, coldest
+ * first, so they keep their order. Blocks that cannot all fit in a fully
+ * associative |to| are dropped from the cold end, and in a set-associative
+ * one each set keeps its most recent; a dropped dirty block is written back
+ * first. Returns 1 on success and -1 if a write-back fails. */
+static int migrate(cache_t *c, cache_shard_t *from, cache_t *next, cache_shard_t *to) {
+  int *slots = malloc(from->size * sizeof(int));
+  int n = slots != NULL ? slots_by_recency(from, slots) : -1;
+  int rc = n != -1 ? 1 : -1;
+
+  for (int i = 0; i < n && rc == 1; i++) {
+    int slot = slots[i], key = from->keys[slot];
+    bool dirty = from->meta[slot].dirty;
+    int dst = -1;
+    if (to->ways != 0) {
+      dst = alloc_way(next, to, key, false);
+    } else if (n - i <= to->size) {
+      dst = to->used++;
+    } else {
+      if (dirty)
+        rc = clean(c, from, slot);
+      continue;
     }
-    // still have to implement the LRU eviction policy here !!!!!!!!!
-  } 
-  return 1;
-} 
+    if (dst == -1)
+      rc = -1;
+    else
+      fill_slot(to, dst, key, slot_block(from, slot), dirty);
+  }
+  free(slots);
+  return n != -1 ? rc : -1;
+}
 
-void cache_update(int disk_num, int block_num, const uint8_t *buf) {
-  for (int i = 0; i < cache_size; i++){
-    if (disk_num == cache[i].disk_num && block_num == cache[i].block_num){
-      memcpy(cache[i].block, buf, 256); // updates the memory in the matching disk/block
+/* Hands the slots of |from| over to |to|, whose own are released; |to|
+ * keeps its lock, counters, ghosts and admission filter. */
+static void take_slots(cache_shard_t *to, cache_shard_t *from) {
+  free(to->keys);
+  free(to->meta);
+  if (to->policy_state != NULL)
+    to->policy_ops->destroy(to->policy_state);
+  to->keys = from->keys;
+  to->meta = from->meta;
+  to->slab = from->slab;
+  to->size = from->size;
+  to->used = from->used;
+  to->ways = from->ways;
+  to->num_sets = from->num_sets;
+  to->clock = from->clock;
+  to->policy_state = from->policy_state;
+  memcpy(to->index, from->index, sizeof(to->index));
+  from->keys = NULL;
+  from->meta = NULL;
+  from->policy_state = NULL;
+}
+
+int cache_clean_ahead_h(cache_t *c, int disk_num, int horizon, cache_clean_fn fn) {
+  if (c == NULL || fn == NULL || horizon < 0) { return -1; }
+  if (disk_num < 0 || disk_num >= JBOD_NUM_DISKS) { return -1; }
+  if (!c->write_back) { return 0; }
+
+  /* The candidates, by block number, so they come out in ascending order. */
+  cache_shard_t *owner[JBOD_NUM_BLOCKS_PER_DISK] = { NULL };
+  int slot_of[JBOD_NUM_BLOCKS_PER_DISK];
+  int *slots = malloc(c->size * sizeof(int));
+  if (slots == NULL)
+    return -1;
+
+  for (int i = 0; i < c->num_shards; i++)
+    pthread_mutex_lock(&c->shards[i].lock);
+
+  int rc = 0;
+  for (int i = 0; i < c->num_shards && rc == 0; i++) {
+    cache_shard_t *shard = &c->shards[i];
+    int n = slots_by_recency(shard, slots);
+    if (n == -1) {
+      rc = -1;
+      break;
+    }
+    /* Empty entries are filled before anything is evicted. */
+    int ahead = (int)((int64_t)horizon * shard->size / c->size) - (shard->size - n);
+    for (int k = 0; k < n && k < ahead; k++) {
+      int slot = slots[k], key = shard->keys[slot];
+      if (shard->meta[slot].dirty && key / JBOD_NUM_BLOCKS_PER_DISK == disk_num) {
+        owner[key % JBOD_NUM_BLOCKS_PER_DISK] = shard;
+        slot_of[key % JBOD_NUM_BLOCKS_PER_DISK] = slot;
+      }
+    }
+  }
+
+  int blocks[JBOD_NUM_BLOCKS_PER_DISK];
+  const uint8_t *bufs[JBOD_NUM_BLOCKS_PER_DISK];
+  int count = 0;
+  for (int b = 0; b < JBOD_NUM_BLOCKS_PER_DISK && rc == 0; b++) {
+    if (owner[b] == NULL)
+      continue;
+    blocks[count] = disk_num * JBOD_NUM_BLOCKS_PER_DISK + b;
+    bufs[count++] = slot_block(owner[b], slot_of[b]);
+  }
+  if (rc == 0 && count > 0 && fn(count, blocks, bufs) != 1)
+    rc = -1;
+  for (int b = 0; b < JBOD_NUM_BLOCKS_PER_DISK && rc == 0; b++) {
+    if (owner[b] == NULL)
+      continue;
+    owner[b]->meta[slot_of[b]].dirty = false;
+    owner[b]->stats.write_backs++;
+  }
+
+  for (int i = c->num_shards - 1; i >= 0; i--)
+    pthread_mutex_unlock(&c->shards[i].lock);
+  free(slots);
+  return rc == 0 ? count : -1;
+}
+
+int cache_resize_h(cache_t *c, int num_entries) {
+  if (c == NULL) { return -1; }
+
+  /* The new layout is built aside, then swapped in, so a failure leaves the
+   * cache as it was. */
+  cache_t *next = cache_open(num_entries, &c->options);
+  if (next == NULL) { return -1; }
+  next->writeback_fn = c->writeback_fn;
+
+  for (int i = 0; i < c->num_shards; i++)
+    pthread_mutex_lock(&c->shards[i].lock);
+
+  /* A pinned block must stay where cache_get said it was. */
+  int rc = 1;
+  for (int i = 0; i < c->num_shards && rc == 1; i++)
+    for (int slot = 0; slot < c->shards[i].size && rc == 1; slot++)
+      if (c->shards[i].meta[slot].pins > 0)
+        rc = -1;
+  for (int i = 0; i < c->num_shards && rc == 1; i++)
+    rc = migrate(c, &c->shards[i], next, &next->shards[i]);
+
+  if (rc == 1) {
+    for (int i = 0; i < c->num_shards; i++) {
+      cache_shard_t *shard = &c->shards[i];
+      cache_shard_t old = { .policy_ops = shard->policy_ops };
+      take_slots(&old, shard);
+      take_slots(shard, &next->shards[i]);
+      take_slots(&next->shards[i], &old);
+      if (shard->ghosts != NULL) {
+        ghost_resize(&shard->ghosts[0], shard->size / 2);
+        ghost_resize(&shard->ghosts[1], shard->size * 2);
+      }
+    }
+    slab_t *arena = c->arena;
+    c->arena = next->arena;
+    next->arena = arena;
+    c->size = num_entries;
+  }
+
+  for (int i = c->num_shards - 1; i >= 0; i--)
+    pthread_mutex_unlock(&c->shards[i].lock);
+  /* |next| now holds whichever layout lost, which must not be flushed. */
+  next->writeback_fn = NULL;
+  cache_close(next);
+  return rc;
+}
+
+int cache_capacity_h(cache_t *c) { return c != NULL ? c->size : 0; }
+
+bool cache_contains_h(cache_t *c, int disk_num, int block_num) {
+  if (c == NULL || !valid_key(disk_num, block_num)) { return false; }
+
+  int key = cache_key(disk_num, block_num);
+  cache_shard_t *shard = lock_shard(c, key);
+  bool found = find_slot(shard, key) != -1;
+  unlock_shard(shard);
+  return found;
+}
+
+bool cache_write_back_h(cache_t *c) { return c != NULL && c->write_back; }
+
+void cache_set_writeback_h(cache_t *c, cache_writeback_fn fn) {
+  if (c != NULL)
+    c->writeback_fn = fn;
+}
+
+void cache_set_stamp_h(cache_t *c, cache_stamp_fn fn) {
+  if (c != NULL)
+    c->stamp_fn = fn;
+}
+
+/* Snapshot file layout, in host byte order: a header, an entry per block
+ * from the first the cache would evict to the last, zero padding up to the
+ * next block boundary, then the payloads in the same order, so that every
+ * payload of a mapped snapshot is block-aligned. */
+#define SNAPSHOT_MAGIC "JBODSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;  /* JBOD_BLOCK_SIZE */
+  uint32_t num_keys;    /* CACHE_NUM_KEYS */
+  uint32_t count;       /* entries */
+  uint32_t table_sum;   /* checksum of the entries */
+  uint32_t reserved;
+} snapshot_header_t;
+
+typedef struct {
+  uint16_t key;
+  uint16_t reserved;
+  uint32_t sum;    /* checksum of the payload */
+  uint64_t stamp;  /* of the block when saved, 0 without a stamp function */
+} snapshot_entry_t;
+
+/* FNV-1a: cheap, and enough to catch a torn or corrupted file. */
+static uint32_t checksum(const void *data, size_t n) {
+  const uint8_t *p = data;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+static size_t snapshot_payloads(uint32_t count) {
+  size_t n = sizeof(snapshot_header_t) + count * sizeof(snapshot_entry_t);
+  return (n + JBOD_BLOCK_SIZE - 1) / JBOD_BLOCK_SIZE * JBOD_BLOCK_SIZE;
+}
+
+/* Syncs the directory holding |path|, so a rename into it survives a crash.
+ * Returns 0 on success and -1 on failure. */
+static int sync_parent(const char *path) {
+  char dir[4096] = ".";
+  const char *slash = strrchr(path, '/');
+  if (slash != NULL) {
+    size_t len = slash > path ? (size_t)(slash - path) : 1;
+    if (len >= sizeof(dir))
+      return -1;
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+  }
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return -1;
+  int rc = fsync(fd);
+  close(fd);
+  return rc;
+}
+
+int cache_save_h(cache_t *c, const char *path) {
+  if (c == NULL || path == NULL) { return -1; }
+  if (c->write_back && c->writeback_fn != NULL && cache_flush_h(c) == -1)
+    return -1;
+
+  snapshot_header_t header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, JBOD_BLOCK_SIZE,
+                               CACHE_NUM_KEYS, 0, 0, 0 };
+  snapshot_entry_t *table = malloc(c->size * sizeof(snapshot_entry_t));
+  uint8_t *payloads = malloc((size_t)c->size * JBOD_BLOCK_SIZE);
+  int *slots = malloc(c->size * sizeof(int));
+  int rc = table != NULL && payloads != NULL && slots != NULL ? 1 : -1;
+
+  /* Blocks are copied out under the locks and written after. Dirty blocks
+   * are left out: their stamp would describe the older copy in JBOD. */
+  for (int i = 0; i < c->num_shards && rc == 1; i++) {
+    cache_shard_t *shard = &c->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    int n = slots_by_recency(shard, slots);
+    for (int j = 0; j < n; j++) {
+      int slot = slots[j], key = shard->keys[slot];
+      if (shard->meta[slot].dirty)
+        continue;
+      uint8_t *payload = payloads + (size_t)header.count * JBOD_BLOCK_SIZE;
+      memcpy(payload, slot_block(shard, slot), JBOD_BLOCK_SIZE);
+      table[header.count++] = (snapshot_entry_t){
+        .key = key,
+        .sum = checksum(payload, JBOD_BLOCK_SIZE),
+        .stamp = c->stamp_fn ? c->stamp_fn(key / JBOD_NUM_BLOCKS_PER_DISK,
+                                            key % JBOD_NUM_BLOCKS_PER_DISK) : 0,
+      };
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if (n == -1)
+      rc = -1;
+  }
+  header.table_sum = checksum(table, header.count * sizeof(snapshot_entry_t));
+
+  /* Written aside, synced and renamed into place, then the rename synced,
+   * so |path| holds either the old snapshot or the whole new one, even
+   * after a crash. Each save gets its own file to write aside, so saves
+   * racing to the same path do not mix. */
+  char tmp[4096];
+  FILE *f = NULL;
+  int fd = -1;
+  if (rc == 1 && snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) < (int)sizeof(tmp))
+    fd = mkstemp(tmp);
+  if (fd != -1 && (f = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    remove(tmp);
+  }
+  if (f != NULL) {
+    static const uint8_t zeros[JBOD_BLOCK_SIZE];
+    size_t pad = snapshot_payloads(header.count) - sizeof(header) -
+                 header.count * sizeof(snapshot_entry_t);
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(table, sizeof(snapshot_entry_t), header.count, f);
+    fwrite(zeros, 1, pad, f);
+    fwrite(payloads, JBOD_BLOCK_SIZE, header.count, f);
+    bool failed = ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0;
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+      remove(tmp);
+      f = NULL;
+    } else if (sync_parent(path) == -1) {
+      f = NULL;
     }
   }
-} // END CACHE_UPDATE -- ALL TESTS PASSED
+  free(table);
+  free(payloads);
+  free(slots);
+  return f != NULL ? 1 : -1;
+}
+
+int cache_load_h(cache_t *c, const char *path) {
+  if (c == NULL || path == NULL) { return -1; }
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd == -1) { return -1; }
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+    close(fd);
+    return -1;
+  }
+  const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) { return -1; }
 
-bool cache_enabled(void) { return false; }
+  const snapshot_header_t *header = (const snapshot_header_t *)map;
+  const snapshot_entry_t *table = (const snapshot_entry_t *)(header + 1);
+  bool valid = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+               header->version == SNAPSHOT_VERSION &&
+               header->block_size == JBOD_BLOCK_SIZE &&
+               header->num_keys == CACHE_NUM_KEYS &&
+               header->count <= CACHE_NUM_KEYS &&
+               (size_t)st.st_size == snapshot_payloads(header->count) +
+                                     (size_t)header->count * JBOD_BLOCK_SIZE &&
+               header->table_sum == checksum(table, header->count * sizeof(*table));
+  if (!valid) {
+    munmap((void *)map, st.st_size);
+    return -1;
+  }
+
+  /* Entries go in coldest first, so the policy ends up in the saved order
+   * and a smaller cache keeps the hottest. A block is dropped if its
+   * payload is corrupt or it changed in JBOD since it was saved. */
+  const uint8_t *payloads = map + snapshot_payloads(header->count);
+  bool seen[CACHE_NUM_KEYS] = { false };
+  int loaded = 0;
+  for (uint32_t i = 0; i < header->count; i++) {
+    int key = table[i].key;
+    const uint8_t *payload = payloads + (size_t)i * JBOD_BLOCK_SIZE;
+    if (key >= CACHE_NUM_KEYS || seen[key] ||
+        table[i].sum != checksum(payload, JBOD_BLOCK_SIZE))
+      continue;
+    seen[key] = true;
+    int disk_num = key / JBOD_NUM_BLOCKS_PER_DISK, block_num = key % JBOD_NUM_BLOCKS_PER_DISK;
+    if (c->stamp_fn != NULL && c->stamp_fn(disk_num, block_num) != table[i].stamp)
+      continue;
+
+    cache_shard_t *shard = lock_shard(c, key);
+    int slot = -1;
+    if (find_slot(shard, key) == -1)
+      slot = alloc_slot(c, shard, key, false);
+    if (slot != -1) {
+      fill_slot(shard, slot, key, payload, false);
+      loaded++;
+    }
+    unlock_shard(shard);
+  }
+  munmap((void *)map, st.st_size);
+  return loaded;
+}
+
+void cache_get_stats_h(cache_t *c, cache_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (c == NULL)
+    return;
+  for (int i = 0; i < c->num_shards; i++) {
+    cache_shard_t *shard = &c->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->queries += shard->stats.queries;
+    stats->hits += shard->stats.hits;
+    stats->inserts += shard->stats.inserts;
+    stats->evictions += shard->stats.evictions;
+    stats->write_backs += shard->stats.write_backs;
+    stats->half_size_hits += shard->stats.half_size_hits;
+    stats->double_size_hits += shard->stats.double_size_hits;
+    stats->rejections += shard->stats.rejections;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  stats->misses = stats->queries - stats->hits;
+}
+
+static void print_hit_rate(const cache_stats_t *stats) {
+  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) stats->hits / stats->queries);
+}
+
+void cache_print_hit_rate_h(cache_t *c) {
+  cache_stats_t stats;
+
+  cache_get_stats_h(c, &stats);
+  print_hit_rate(&stats);
+}
+
+/* The functions below work on the default instance. */
+
+int cache_create(int num_entries) {
+  return cache_create_ex(num_entries, NULL);
+}
+
+int cache_create_ex(int num_entries, const cache_options_t *options) {
+  if (create_count == 1) { return -1; } // cache_create cannot be ran twice
+
+  default_cache = cache_open(num_entries, options);
+  if (default_cache == NULL) { return -1; }
+  cache_set_writeback_h(default_cache, default_writeback_fn);
+  cache_set_stamp_h(default_cache, default_stamp_fn);
+  memset(&last_stats, 0, sizeof(last_stats));
+  create_count++;
+  return 1;
+}
+
+int cache_destroy(void) {
+  if (create_count == 0) { return -1; }
+  // flush first, so the write-backs it makes are counted in last_stats
+  if (default_cache->write_back && default_cache->writeback_fn != NULL)
+    cache_flush_h(default_cache);
+  cache_get_stats_h(default_cache, &last_stats);
+  cache_close(default_cache);
+  default_cache = NULL;
+  create_count = 0;
+  return 1;
+}
+
+int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
+  return cache_lookup_h(default_cache, disk_num, block_num, buf);
+}
+
+const uint8_t *cache_get(int disk_num, int block_num) {
+  return cache_get_h(default_cache, disk_num, block_num);
+}
+
+void cache_put(int disk_num, int block_num) {
+  cache_put_h(default_cache, disk_num, block_num);
+}
+
+int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_insert_h(default_cache, disk_num, block_num, buf);
+}
+
+void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+  cache_update_h(default_cache, disk_num, block_num, buf);
+}
+
+int cache_write(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_write_h(default_cache, disk_num, block_num, buf);
+}
+
+int cache_flush(void) { return cache_flush_h(default_cache); }
+
+int cache_clean_ahead(int disk_num, int horizon, cache_clean_fn fn) {
+  return cache_clean_ahead_h(default_cache, disk_num, horizon, fn);
+}
+
+int cache_resize(int num_entries) { return cache_resize_h(default_cache, num_entries); }
+
+bool cache_enabled(void) { return default_cache != NULL; }
+
+int cache_capacity(void) { return cache_capacity_h(default_cache); }
+
+bool cache_contains(int disk_num, int block_num) {
+  return cache_contains_h(default_cache, disk_num, block_num);
+}
+
+bool cache_write_back(void) { return cache_write_back_h(default_cache); }
+
+int cache_save(const char *path) { return cache_save_h(default_cache, path); }
+
+int cache_load(const char *path) { return cache_load_h(default_cache, path); }
+
+void cache_set_stamp(cache_stamp_fn fn) {
+  default_stamp_fn = fn;
+  cache_set_stamp_h(default_cache, fn);
+}
+
+void cache_set_writeback(cache_writeback_fn fn) {
+  default_writeback_fn = fn;
+  cache_set_writeback_h(default_cache, fn);
+}
+
+void cache_get_stats(cache_stats_t *stats) {
+  if (default_cache != NULL)
+    cache_get_stats_h(default_cache, stats);
+  else
+    *stats = last_stats;
+}
 
 void cache_print_hit_rate(void) {
-  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) num_hits / num_queries);
+  cache_stats_t stats;
+
+  cache_get_stats(&stats);
+  print_hit_rate(&stats);
+}
+
+const char *cache_policy_name(cache_policy_t policy) {
+  const struct cache_policy_ops *ops = cache_policy_lookup(policy);
+  return ops ? ops->name : NULL;
+}
+
+int cache_policy_from_name(const char *name) {
+  for (int i = 0; i < CACHE_NUM_POLICIES; i++)
+    if (strcmp(cache_policy_lookup(i)->name, name) == 0)
+      return i;
+  return -1;
 }
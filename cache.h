@@ -7,19 +7,66 @@
 #include "jbod.h"
 #include "util.h"
 
+/* Eviction policies selectable with cache_create_ex. */
+typedef enum {
+  CACHE_POLICY_LRU,
+  CACHE_POLICY_CLOCK,
+  CACHE_POLICY_2Q,
+  CACHE_POLICY_ARC,
+  CACHE_POLICY_LFU,
+  CACHE_NUM_POLICIES,
+} cache_policy_t;
+
 typedef struct {
-  bool valid;
-  int disk_num;
-  int block_num;
-  uint8_t block[JBOD_BLOCK_SIZE];
-  int access_time;
-} cache_entry_t;
+  cache_policy_t policy;
+  bool write_back;  /* absorb writes, write dirty blocks to JBOD later */
+  int shards;       /* independently locked partitions; 0 or 1 for one */
+  int ways;         /* set-associative with this many ways; 0 for fully */
+  bool ghost;       /* also estimate the hit rate at half and twice the size */
+  bool admission;   /* TinyLFU admission filter in front of cache_insert */
+} cache_options_t;
+
+/* Writes a dirty block back to JBOD. Returns 1 on success and -1 on failure. */
+typedef int (*cache_writeback_fn)(int disk_num, int block_num, const uint8_t *buf);
+
+/* Writes the |count| blocks numbered |blocks|, on one disk in ascending
+ * order, from |bufs| to JBOD together. Returns 1 on success and -1 on
+ * failure. */
+typedef int (*cache_clean_fn)(int count, const int *blocks, const uint8_t *const *bufs);
+
+/* Returns a stamp of the current contents of a block in JBOD, which changes
+ * whenever the block is written. */
+typedef uint64_t (*cache_stamp_fn)(int disk_num, int block_num);
 
 /* Returns 1 on success and -1 on failure. Should allocate a space for
- * |num_entries| cache entries, each of type cache_entry_t. Calling it again
- * without first calling cache_destroy (see below) should fail. */
+ * |num_entries| cache entries. Calling it again without first calling
+ * cache_destroy (see below) should fail. */
 int cache_create(int num_entries);
 
+/* Same as cache_create, but with the behaviour chosen by |options|. A NULL
+ * |options| gives the defaults, which is an LRU cache.
+ *
+ * Every function below may be called from several threads at once, except
+ * cache_create, cache_destroy and cache_set_writeback. With more than one
+ * shard the entries are split evenly between them, and each shard evicts
+ * on its own, so the policy is only followed within a shard.
+ *
+ * With |ways| set, each shard is split into sets of that many entries, a
+ * block can only be cached in the set it hashes to, and the least recently
+ * used entry of that set is evicted; entries that do not fill a whole set
+ * are left unused. This mode requires the LRU policy.
+ *
+ * With |ghost| set, each shard also keeps the keys, but no data, of an LRU
+ * cache of half and one of twice its size, and counts the lookups those
+ * would have hit (see cache_stats_t). They follow LRU whatever the policy.
+ *
+ * With |admission| set, once a shard is full cache_insert only replaces the
+ * entry the policy would evict with a block that has been used more often
+ * recently, as estimated by a TinyLFU filter (see tinylfu.h) fed by lookup
+ * hits, inserts, updates and writes, or with one it refused a moment ago;
+ * otherwise it fails and the entry stays. cache_write is never refused. */
+int cache_create_ex(int num_entries, const cache_options_t *options);
+
 /* Returns 1 on success and -1 on failure. Frees the space allocated by
  * cache_create function above. */
 int cache_destroy(void);
@@ -29,10 +76,24 @@ int cache_destroy(void);
  * block to |buf|, which must not be NULL. */
 int cache_lookup(int disk_num, int block_num, uint8_t *buf);
 
+/* Looks up the block located at |disk_num| and |block_num| like cache_lookup,
+ * but instead of copying it returns a read-only pointer into the cache, or
+ * NULL on a miss. The entry is pinned, so it is not evicted, until released
+ * with cache_put; the pointer is valid until then. A pin does not stop
+ * cache_update or cache_write of the same block from changing the data
+ * under the pointer: callers that read through it while the block may be
+ * written must keep those writers out themselves, as mdadm does with its
+ * block locks. */
+const uint8_t *cache_get(int disk_num, int block_num);
+
+/* Releases one pin taken by cache_get on |disk_num| and |block_num|. */
+void cache_put(int disk_num, int block_num);
+
 /* Returns 1 on success and -1 on failure. Inserts an entry for |disk_num| and
  * |block_num| into cache. Returns -1 if there is already an existing entry in the cache
  * with |disk_num| and |block_num|.If there cache is full, should evict least
- * recently used entry and insert the new entry. */
+ * recently used entry and insert the new entry. Fails if every entry is
+ * pinned, or if an admission filter refuses the block. */
 int cache_insert(int disk_num, int block_num, const uint8_t *buf);
 
 /* If the entry with |disk_num| and |block_num| exists, updates the
@@ -42,7 +103,131 @@ void cache_update(int disk_num, int block_num, const uint8_t *buf);
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
+/* Returns the number of entries the cache was created with, 0 if disabled. */
+int cache_capacity(void);
+
+/* Returns true if the block is cached. Unlike cache_lookup this is not a
+ * use of the block: it neither counts as a query nor changes recency. */
+bool cache_contains(int disk_num, int block_num);
+
+/* Returns true if the cache was created in write-back mode. */
+bool cache_write_back(void);
+
+/* Sets the function used to write dirty blocks back, on eviction and in
+ * cache_flush. mdadm installs it while mounted; NULL removes it. */
+void cache_set_writeback(cache_writeback_fn fn);
+
+/* Sets the function cache_save and cache_load use to tell whether a block
+ * changed in JBOD in between; NULL trusts every saved block. mdadm installs
+ * it on mount. */
+void cache_set_stamp(cache_stamp_fn fn);
+
+/* Returns 1 on success and -1 on failure. Flushes a write-back cache, then
+ * writes a snapshot of the cached blocks to the file at |path|: a versioned
+ * header, the keys and stamps of the blocks in the order the policy would
+ * evict them, and the blocks themselves, block-aligned so the file can be
+ * mapped. Blocks still dirty after the flush are left out. The file is
+ * replaced atomically and synced to disk, so whatever happens |path| holds
+ * the old snapshot or the new one, and the new one once this returns 1. */
+int cache_save(const char *path);
+
+/* Loads the snapshot at |path| into the cache, coldest block first, so a
+ * cache at least as large as the saved one ends up with the same contents
+ * in the same order, and a smaller one with the hottest blocks. Blocks that
+ * are already cached, fail their checksum or whose stamp changed since the
+ * save are skipped. Returns the number of blocks loaded, or -1 if the file
+ * cannot be read or is not a snapshot of this format and geometry. */
+int cache_load(const char *path);
+
+/* Returns 1 on success and -1 on failure. Stores a block written by the user
+ * in a write-back cache, inserting or updating it and marking it dirty. The
+ * block reaches JBOD only when it is evicted, flushed or cleaned ahead. */
+int cache_write(int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns 1 on success and -1 on failure. Writes every dirty block back in
+ * (disk, block) order and marks it clean. */
+int cache_flush(void);
+
+/* Writes back the dirty blocks on |disk_num| that the next |horizon| inserts
+ * could evict, in one call to |fn|, and marks them clean, so they need no
+ * write-back of their own when they are evicted; |horizon| is split between
+ * the shards like the entries. Returns the number of blocks written back,
+ * 0 if the cache is not write-back, or -1 if |fn| fails. */
+int cache_clean_ahead(int disk_num, int horizon, cache_clean_fn fn);
+
+/* Returns 1 on success and -1 on failure. Changes the number of entries to
+ * |num_entries|, within the limits of cache_create, keeping the cached
+ * blocks and the order the policy would evict them in. When shrinking, the
+ * blocks that would be evicted first are dropped, dirty ones written back.
+ * Policies with more than one list (2Q, ARC) restart with every block on
+ * the first, and LFU with every count at one, in that order. Counters,
+ * ghosts (resized) and the admission filter carry over. Fails, leaving the
+ * cache as it was, if a block is pinned or a write-back fails. */
+int cache_resize(int num_entries);
+
 /* Prints the hit rate of the cache. */
 void cache_print_hit_rate(void);
 
+/* Cache counters. A lookup (cache_lookup or cache_get) is either a hit or a
+ * miss; inserts count blocks added by cache_insert or cache_write, evictions
+ * the entries replaced to make room for them and write_backs the dirty
+ * blocks written to JBOD. */
+typedef struct {
+  uint64_t queries;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t evictions;
+  uint64_t write_backs;
+  /* Ghost mode only: lookups an LRU cache of half and of twice the size
+   * would have hit. */
+  uint64_t half_size_hits;
+  uint64_t double_size_hits;
+  uint64_t rejections;  /* inserts refused by the admission filter */
+} cache_stats_t;
+
+/* Copies the counters of the cache into |stats|. After cache_destroy these
+ * are the final counters of the destroyed cache, until the next create. */
+void cache_get_stats(cache_stats_t *stats);
+
+/* Cache instances. The functions above operate on a single default instance
+ * owned by this module, which mdadm uses. The ones below take an explicit
+ * handle, so any number of independently sized and configured caches can
+ * live side by side; each behaves like the corresponding function above. */
+typedef struct cache cache_t;
+
+/* Returns a new cache of |num_entries| entries configured by |options| (see
+ * cache_create_ex), or NULL on failure. */
+cache_t *cache_open(int num_entries, const cache_options_t *options);
+
+/* Flushes |c| if it is a write-back cache with a write-back function, then
+ * frees it. */
+void cache_close(cache_t *c);
+
+int cache_lookup_h(cache_t *c, int disk_num, int block_num, uint8_t *buf);
+const uint8_t *cache_get_h(cache_t *c, int disk_num, int block_num);
+void cache_put_h(cache_t *c, int disk_num, int block_num);
+int cache_insert_h(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+void cache_update_h(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+int cache_write_h(cache_t *c, int disk_num, int block_num, const uint8_t *buf);
+int cache_flush_h(cache_t *c);
+int cache_clean_ahead_h(cache_t *c, int disk_num, int horizon, cache_clean_fn fn);
+int cache_resize_h(cache_t *c, int num_entries);
+int cache_capacity_h(cache_t *c);
+bool cache_contains_h(cache_t *c, int disk_num, int block_num);
+bool cache_write_back_h(cache_t *c);
+void cache_set_writeback_h(cache_t *c, cache_writeback_fn fn);
+void cache_set_stamp_h(cache_t *c, cache_stamp_fn fn);
+int cache_save_h(cache_t *c, const char *path);
+int cache_load_h(cache_t *c, const char *path);
+void cache_print_hit_rate_h(cache_t *c);
+void cache_get_stats_h(cache_t *c, cache_stats_t *stats);
+
+/* Returns the short name of |policy| ("lru", "arc", ...), or NULL if it is
+ * not a valid policy. */
+const char *cache_policy_name(cache_policy_t policy);
+
+/* Returns the policy named |name|, or -1 if there is no such policy. */
+int cache_policy_from_name(const char *name);
+
 #endif
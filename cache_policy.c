@@ -0,0 +1,719 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_policy.h"
+
+/* Doubly-linked lists over slot (or key) numbers. A node's links live in an
+ * array owned by the policy, so a node can be on at most one list per array. */
+typedef struct {
+  int prev;
+  int next;
+} plink_t;
+
+typedef struct {
+  int head;  /* most recently inserted */
+  int tail;  /* least recently inserted */
+  int len;
+} plist_t;
+
+static void plist_init(plist_t *l) {
+  l->head = l->tail = -1;
+  l->len = 0;
+}
+
+static void plist_push_front(plist_t *l, plink_t *links, int i) {
+  links[i].prev = -1;
+  links[i].next = l->head;
+  if (l->head != -1)
+    links[l->head].prev = i;
+  else
+    l->tail = i;
+  l->head = i;
+  l->len++;
+}
+
+static void plist_unlink(plist_t *l, plink_t *links, int i) {
+  if (links[i].prev != -1)
+    links[links[i].prev].next = links[i].next;
+  else
+    l->head = links[i].next;
+  if (links[i].next != -1)
+    links[links[i].next].prev = links[i].prev;
+  else
+    l->tail = links[i].prev;
+  l->len--;
+}
+
+/* Links |i| back in where plist_unlink took it out, which is only right if
+ * |l| has not changed since. */
+static void plist_relink(plist_t *l, plink_t *links, int i) {
+  if (links[i].prev != -1)
+    links[links[i].prev].next = i;
+  else
+    l->head = i;
+  if (links[i].next != -1)
+    links[links[i].next].prev = i;
+  else
+    l->tail = i;
+  l->len++;
+}
+
+static int plist_pop_back(plist_t *l, plink_t *links) {
+  int i = l->tail;
+  if (i != -1)
+    plist_unlink(l, links, i);
+  return i;
+}
+
+/* Stores the nodes of |l| in |out| from the tail to the head and returns how
+ * many there are. */
+static int plist_walk_back(const plist_t *l, const plink_t *links, int *out) {
+  int n = 0;
+  for (int i = l->tail; i != -1; i = links[i].prev)
+    out[n++] = i;
+  return n;
+}
+
+/* Stores the nodes of |a| and |b| in |out|, each from the tail, taking the
+ * tail of |a| while |prefer_a| says so for the remaining lengths, as an
+ * eviction choosing between two lists would. Returns how many there are. */
+static int plist_merge_back(const plist_t *a, const plist_t *b, const plink_t *links,
+                            bool (*prefer_a)(const void *st, int len_a, int len_b),
+                            const void *st, int *out) {
+  int n = 0, i = a->tail, j = b->tail, len_a = a->len, len_b = b->len;
+  while (i != -1 || j != -1) {
+    if (j == -1 || (i != -1 && prefer_a(st, len_a, len_b))) {
+      out[n++] = i;
+      i = links[i].prev;
+      len_a--;
+    } else {
+      out[n++] = j;
+      j = links[j].prev;
+      len_b--;
+    }
+  }
+  return n;
+}
+
+/* Unlinks and returns the node closest to the tail that is not pinned, or -1
+ * if there is none. */
+static int plist_pop_unpinned(plist_t *l, plink_t *links,
+                              cache_pinned_fn pinned, void *ctx) {
+  int i = l->tail;
+  while (i != -1 && pinned(ctx, i))
+    i = links[i].prev;
+  if (i != -1)
+    plist_unlink(l, links, i);
+  return i;
+}
+
+/*
+ * LRU: a single recency list; hits move to the front, the tail is evicted.
+ */
+
+typedef struct {
+  plist_t list;
+  plink_t links[];
+} lru_state_t;
+
+static void *lru_create(int num_entries) {
+  lru_state_t *st = malloc(sizeof(*st) + num_entries * sizeof(plink_t));
+  if (st)
+    plist_init(&st->list);
+  return st;
+}
+
+static void lru_insert(void *state, int slot, int key) {
+  lru_state_t *st = state;
+  plist_push_front(&st->list, st->links, slot);
+}
+
+static void lru_touch(void *state, int slot) {
+  lru_state_t *st = state;
+  if (st->list.head == slot)
+    return;
+  plist_unlink(&st->list, st->links, slot);
+  plist_push_front(&st->list, st->links, slot);
+}
+
+static int lru_evict(void *state, int key, cache_pinned_fn pinned, void *ctx) {
+  lru_state_t *st = state;
+  return plist_pop_unpinned(&st->list, st->links, pinned, ctx);
+}
+
+static void lru_restore(void *state, int slot) {
+  lru_state_t *st = state;
+  plist_relink(&st->list, st->links, slot);
+}
+
+static int lru_order(void *state, int *slots) {
+  lru_state_t *st = state;
+  return plist_walk_back(&st->list, st->links, slots);
+}
+
+/*
+ * CLOCK: second chance. A hand sweeps the slots in order, clearing reference
+ * bits, and evicts the first slot whose bit is already clear.
+ */
+
+enum { CLOCK_REF = 1, CLOCK_HELD = 2 };
+
+typedef struct {
+  int num_entries;
+  int hand;
+  int start;        /* where the hand was before the last evict */
+  int num_cleared;
+  uint8_t *bits;    /* CLOCK_REF and CLOCK_HELD, per slot */
+  int cleared[];    /* slots whose bit the last evict cleared */
+} clock_state_t;
+
+static void *clock_create(int num_entries) {
+  clock_state_t *st = calloc(1, sizeof(*st) + num_entries * (sizeof(int) + 1));
+  if (st) {
+    st->num_entries = num_entries;
+    st->bits = (uint8_t *)(st->cleared + num_entries);
+  }
+  return st;
+}
+
+static void clock_insert(void *state, int slot, int key) {
+  clock_state_t *st = state;
+  st->bits[slot] = CLOCK_HELD | CLOCK_REF;
+}
+
+static void clock_touch(void *state, int slot) {
+  clock_state_t *st = state;
+  st->bits[slot] |= CLOCK_REF;
+}
+
+static int clock_evict(void *state, int key, cache_pinned_fn pinned, void *ctx) {
+  clock_state_t *st = state;
+  st->start = st->hand;
+  st->num_cleared = 0;
+  /* Two full turns clear every reference bit, so if no slot turned up by
+   * then, all of them are pinned. */
+  for (int n = 0; n <= 2 * st->num_entries; n++) {
+    int slot = st->hand;
+    st->hand = (st->hand + 1) % st->num_entries;
+    if (pinned(ctx, slot))
+      continue;
+    if (!(st->bits[slot] & CLOCK_REF))
+      return slot;
+    st->bits[slot] &= ~CLOCK_REF;
+    st->cleared[st->num_cleared++] = slot;
+  }
+  return -1;
+}
+
+static void clock_restore(void *state, int slot) {
+  clock_state_t *st = state;
+  for (int i = 0; i < st->num_cleared; i++)
+    st->bits[st->cleared[i]] |= CLOCK_REF;
+  st->hand = st->start;
+}
+
+static int clock_order(void *state, int *slots) {
+  clock_state_t *st = state;
+  int n = 0;
+  /* The first turn of the hand takes the unreferenced slots, the second
+   * the rest, whose bits the first turn cleared. */
+  for (int ref = 0; ref <= CLOCK_REF; ref += CLOCK_REF) {
+    for (int i = 0; i < st->num_entries; i++) {
+      int slot = (st->hand + i) % st->num_entries;
+      if (st->bits[slot] == (CLOCK_HELD | ref))
+        slots[n++] = slot;
+    }
+  }
+  return n;
+}
+
+/*
+ * 2Q (Johnson & Shasha): new blocks enter a FIFO (A1in) holding a quarter of
+ * the cache. Blocks evicted from it are remembered on a ghost list (A1out);
+ * only a block that is requested again while remembered is promoted to the
+ * main LRU (Am). A one-pass scan therefore never displaces Am.
+ */
+
+enum { TWOQ_A1IN, TWOQ_AM };
+
+typedef struct {
+  int kin;   /* target size of A1in */
+  int kout;  /* capacity of A1out */
+  plist_t a1in;
+  plist_t am;
+  plist_t a1out;
+  int dropped;     /* ghost the last evict pushed out of A1out, or -1 */
+  plink_t ghost_links[CACHE_NUM_KEYS];
+  bool ghost[CACHE_NUM_KEYS];
+  int *keys;       /* key held by each slot */
+  uint8_t *queue;  /* TWOQ_A1IN or TWOQ_AM, per slot */
+  plink_t links[];
+} twoq_state_t;
+
+static void *twoq_create(int num_entries) {
+  twoq_state_t *st = calloc(1, sizeof(*st) + num_entries * sizeof(plink_t));
+  if (st == NULL)
+    return NULL;
+  st->keys = calloc(num_entries, sizeof(int));
+  st->queue = calloc(num_entries, sizeof(uint8_t));
+  if (st->keys == NULL || st->queue == NULL) {
+    free(st->keys);
+    free(st->queue);
+    free(st);
+    return NULL;
+  }
+  st->kin = num_entries / 4 > 0 ? num_entries / 4 : 1;
+  st->kout = num_entries / 2 > 0 ? num_entries / 2 : 1;
+  plist_init(&st->a1in);
+  plist_init(&st->am);
+  plist_init(&st->a1out);
+  return st;
+}
+
+static void twoq_destroy(void *state) {
+  twoq_state_t *st = state;
+  free(st->keys);
+  free(st->queue);
+  free(st);
+}
+
+static void twoq_insert(void *state, int slot, int key) {
+  twoq_state_t *st = state;
+  st->keys[slot] = key;
+  if (st->ghost[key]) {
+    plist_unlink(&st->a1out, st->ghost_links, key);
+    st->ghost[key] = false;
+    st->queue[slot] = TWOQ_AM;
+    plist_push_front(&st->am, st->links, slot);
+  } else {
+    st->queue[slot] = TWOQ_A1IN;
+    plist_push_front(&st->a1in, st->links, slot);
+  }
+}
+
+static void twoq_touch(void *state, int slot) {
+  twoq_state_t *st = state;
+  /* Hits in A1in are deliberately ignored: correlated references right after
+   * the first one do not prove the block is hot. */
+  if (st->queue[slot] == TWOQ_AM && st->am.head != slot) {
+    plist_unlink(&st->am, st->links, slot);
+    plist_push_front(&st->am, st->links, slot);
+  }
+}
+
+static int twoq_evict(void *state, int key, cache_pinned_fn pinned, void *ctx) {
+  twoq_state_t *st = state;
+  int victim = -1;
+
+  if (st->a1in.len > st->kin || st->am.len == 0)
+    victim = plist_pop_unpinned(&st->a1in, st->links, pinned, ctx);
+  if (victim == -1)
+    victim = plist_pop_unpinned(&st->am, st->links, pinned, ctx);
+  if (victim == -1)
+    victim = plist_pop_unpinned(&st->a1in, st->links, pinned, ctx);
+  if (victim == -1 || st->queue[victim] != TWOQ_A1IN)
+    return victim;
+
+  int vkey = st->keys[victim];
+  st->dropped = -1;
+  if (st->a1out.len >= st->kout) {
+    st->dropped = plist_pop_back(&st->a1out, st->ghost_links);
+    st->ghost[st->dropped] = false;
+  }
+  plist_push_front(&st->a1out, st->ghost_links, vkey);
+  st->ghost[vkey] = true;
+  return victim;
+}
+
+static void twoq_restore(void *state, int slot) {
+  twoq_state_t *st = state;
+  if (st->queue[slot] == TWOQ_AM) {
+    plist_relink(&st->am, st->links, slot);
+    return;
+  }
+  plist_relink(&st->a1in, st->links, slot);
+  plist_unlink(&st->a1out, st->ghost_links, st->keys[slot]);
+  st->ghost[st->keys[slot]] = false;
+  if (st->dropped != -1) {
+    plist_relink(&st->a1out, st->ghost_links, st->dropped);
+    st->ghost[st->dropped] = true;
+  }
+}
+
+static bool twoq_prefer_a1in(const void *state, int a1in_len, int am_len) {
+  const twoq_state_t *st = state;
+  return a1in_len > st->kin || am_len == 0;
+}
+
+static int twoq_order(void *state, int *slots) {
+  twoq_state_t *st = state;
+  return plist_merge_back(&st->a1in, &st->am, st->links, twoq_prefer_a1in, st, slots);
+}
+
+/*
+ * ARC (Megiddo & Modha): T1 holds blocks seen once recently, T2 blocks seen
+ * at least twice. B1/B2 remember keys recently evicted from T1/T2 and steer
+ * the target size |p| of T1 towards whichever side is producing ghost hits.
+ */
+
+enum { ARC_NONE, ARC_T1, ARC_T2, ARC_B1, ARC_B2 };
+
+typedef struct {
+  int c;            /* cache size */
+  int p;            /* target size of T1 */
+  int prepared;     /* key whose directory update evict already did, or -1 */
+  struct {          /* what the last evict changed besides the victim */
+    int p;
+    int forgot;     /* ghost trimmed from |forgot_from|, or -1 */
+    uint8_t forgot_from;
+    bool ghosted;   /* the victim's key went onto B1 or B2 */
+  } undo;
+  plist_t t1, t2;   /* resident, over slots */
+  plist_t b1, b2;   /* ghosts, over keys */
+  plink_t ghost_links[CACHE_NUM_KEYS];
+  uint8_t where[CACHE_NUM_KEYS];  /* ARC_NONE, ARC_B1 or ARC_B2, per key */
+  int *keys;                      /* key held by each slot */
+  uint8_t *list;                  /* ARC_T1 or ARC_T2, per slot */
+  plink_t links[];
+} arc_state_t;
+
+static void *arc_create(int num_entries) {
+  arc_state_t *st = calloc(1, sizeof(*st) + num_entries * sizeof(plink_t));
+  if (st == NULL)
+    return NULL;
+  st->keys = calloc(num_entries, sizeof(int));
+  st->list = calloc(num_entries, sizeof(uint8_t));
+  if (st->keys == NULL || st->list == NULL) {
+    free(st->keys);
+    free(st->list);
+    free(st);
+    return NULL;
+  }
+  st->c = num_entries;
+  st->prepared = -1;
+  plist_init(&st->t1);
+  plist_init(&st->t2);
+  plist_init(&st->b1);
+  plist_init(&st->b2);
+  return st;
+}
+
+static void arc_destroy(void *state) {
+  arc_state_t *st = state;
+  free(st->keys);
+  free(st->list);
+  free(st);
+}
+
+static void arc_forget_ghost(arc_state_t *st, plist_t *l) {
+  int key = plist_pop_back(l, st->ghost_links);
+  if (key != -1) {
+    st->undo.forgot = key;
+    st->undo.forgot_from = st->where[key];
+    st->where[key] = ARC_NONE;
+  }
+}
+
+/* Moves the LRU unpinned block of T1 or T2 to the matching ghost list and
+ * returns its slot, or -1 if every block is pinned. */
+static int arc_replace(arc_state_t *st, int key, cache_pinned_fn pinned, void *ctx) {
+  bool from_t1 = st->t1.len > 0 &&
+      ((st->where[key] == ARC_B2 && st->t1.len == st->p) || st->t1.len > st->p);
+
+  int victim = plist_pop_unpinned(from_t1 ? &st->t1 : &st->t2, st->links, pinned, ctx);
+  if (victim == -1) {
+    from_t1 = !from_t1;
+    victim = plist_pop_unpinned(from_t1 ? &st->t1 : &st->t2, st->links, pinned, ctx);
+  }
+  if (victim == -1)
+    return -1;
+  int vkey = st->keys[victim];
+  st->where[vkey] = from_t1 ? ARC_B1 : ARC_B2;
+  plist_push_front(from_t1 ? &st->b1 : &st->b2, st->ghost_links, vkey);
+  st->undo.ghosted = true;
+  return victim;
+}
+
+/* Adapts |p| and trims the ghost directory for a miss on |key|. If |full|,
+ * also frees and returns an unpinned slot; otherwise returns -1. */
+static int arc_miss(arc_state_t *st, int key, bool full,
+                    cache_pinned_fn pinned, void *ctx) {
+  int victim = -1;
+
+  if (st->where[key] == ARC_B1) {
+    int delta = st->b1.len >= st->b2.len ? 1 : st->b2.len / st->b1.len;
+    st->p = st->p + delta < st->c ? st->p + delta : st->c;
+    if (full)
+      victim = arc_replace(st, key, pinned, ctx);
+  } else if (st->where[key] == ARC_B2) {
+    int delta = st->b2.len >= st->b1.len ? 1 : st->b1.len / st->b2.len;
+    st->p = st->p - delta > 0 ? st->p - delta : 0;
+    if (full)
+      victim = arc_replace(st, key, pinned, ctx);
+  } else if (st->t1.len + st->b1.len >= st->c) {
+    if (st->t1.len < st->c) {
+      arc_forget_ghost(st, &st->b1);
+      if (full)
+        victim = arc_replace(st, key, pinned, ctx);
+    } else {
+      /* B1 is empty and T1 fills the cache: drop T1's LRU outright. */
+      victim = plist_pop_unpinned(&st->t1, st->links, pinned, ctx);
+    }
+  } else {
+    int total = st->t1.len + st->t2.len + st->b1.len + st->b2.len;
+    if (total >= 2 * st->c)
+      arc_forget_ghost(st, &st->b2);
+    if (full)
+      victim = arc_replace(st, key, pinned, ctx);
+  }
+  return victim;
+}
+
+static void arc_insert(void *state, int slot, int key) {
+  arc_state_t *st = state;
+  if (st->prepared != key)
+    arc_miss(st, key, false, NULL, NULL);
+  st->prepared = -1;
+
+  st->keys[slot] = key;
+  if (st->where[key] == ARC_B1 || st->where[key] == ARC_B2) {
+    plist_unlink(st->where[key] == ARC_B1 ? &st->b1 : &st->b2,
+                 st->ghost_links, key);
+    st->where[key] = ARC_NONE;
+    st->list[slot] = ARC_T2;
+    plist_push_front(&st->t2, st->links, slot);
+  } else {
+    st->list[slot] = ARC_T1;
+    plist_push_front(&st->t1, st->links, slot);
+  }
+}
+
+static void arc_touch(void *state, int slot) {
+  arc_state_t *st = state;
+  plist_unlink(st->list[slot] == ARC_T1 ? &st->t1 : &st->t2, st->links, slot);
+  st->list[slot] = ARC_T2;
+  plist_push_front(&st->t2, st->links, slot);
+}
+
+/* Puts back the ghost the last evict trimmed and the target size it had,
+ * for an evict that freed no slot or whose victim stays. */
+static void arc_undo_miss(arc_state_t *st) {
+  if (st->undo.forgot != -1) {
+    st->where[st->undo.forgot] = st->undo.forgot_from;
+    plist_relink(st->undo.forgot_from == ARC_B1 ? &st->b1 : &st->b2,
+                 st->ghost_links, st->undo.forgot);
+  }
+  st->p = st->undo.p;
+}
+
+static int arc_evict(void *state, int key, cache_pinned_fn pinned, void *ctx) {
+  arc_state_t *st = state;
+  st->undo.p = st->p;
+  st->undo.forgot = -1;
+  st->undo.ghosted = false;
+  int victim = arc_miss(st, key, true, pinned, ctx);
+  st->prepared = victim != -1 ? key : -1;
+  if (victim == -1)
+    arc_undo_miss(st);
+  return victim;
+}
+
+static void arc_restore(void *state, int slot) {
+  arc_state_t *st = state;
+  int vkey = st->keys[slot];
+  if (st->undo.ghosted) {
+    plist_unlink(st->where[vkey] == ARC_B1 ? &st->b1 : &st->b2, st->ghost_links, vkey);
+    st->where[vkey] = ARC_NONE;
+  }
+  plist_relink(st->list[slot] == ARC_T1 ? &st->t1 : &st->t2, st->links, slot);
+  arc_undo_miss(st);
+  st->prepared = -1;
+}
+
+/* The order arc_replace takes blocks in on misses that hit no ghost, with
+ * |p| as it is now. */
+static bool arc_prefer_t1(const void *state, int t1_len, int t2_len) {
+  const arc_state_t *st = state;
+  return t1_len > st->p || t2_len == 0;
+}
+
+static int arc_order(void *state, int *slots) {
+  arc_state_t *st = state;
+  return plist_merge_back(&st->t1, &st->t2, st->links, arc_prefer_t1, st, slots);
+}
+
+/*
+ * LFU: a binary min-heap of slots ordered by access count, ties broken by
+ * least recent access.
+ */
+
+typedef struct {
+  int size;
+  int tick;
+  int *heap;       /* slots, heap-ordered */
+  int *pos;        /* index of each slot in |heap| */
+  int *freq;       /* accesses per slot */
+  int *last;       /* tick of the last access per slot */
+} lfu_state_t;
+
+static void *lfu_create(int num_entries) {
+  lfu_state_t *st = calloc(1, sizeof(*st));
+  if (st == NULL)
+    return NULL;
+  st->heap = calloc(num_entries, sizeof(int));
+  st->pos = calloc(num_entries, sizeof(int));
+  st->freq = calloc(num_entries, sizeof(int));
+  st->last = calloc(num_entries, sizeof(int));
+  if (!st->heap || !st->pos || !st->freq || !st->last) {
+    free(st->heap);
+    free(st->pos);
+    free(st->freq);
+    free(st->last);
+    free(st);
+    return NULL;
+  }
+  return st;
+}
+
+static void lfu_destroy(void *state) {
+  lfu_state_t *st = state;
+  free(st->heap);
+  free(st->pos);
+  free(st->freq);
+  free(st->last);
+  free(st);
+}
+
+static bool lfu_less(lfu_state_t *st, int a, int b) {
+  if (st->freq[a] != st->freq[b])
+    return st->freq[a] < st->freq[b];
+  return st->last[a] < st->last[b];
+}
+
+static void lfu_swap(lfu_state_t *st, int i, int j) {
+  int t = st->heap[i];
+  st->heap[i] = st->heap[j];
+  st->heap[j] = t;
+  st->pos[st->heap[i]] = i;
+  st->pos[st->heap[j]] = j;
+}
+
+static void lfu_sift_down(lfu_state_t *st, int i) {
+  for (;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    if (l < st->size && lfu_less(st, st->heap[l], st->heap[m]))
+      m = l;
+    if (r < st->size && lfu_less(st, st->heap[r], st->heap[m]))
+      m = r;
+    if (m == i)
+      return;
+    lfu_swap(st, i, m);
+    i = m;
+  }
+}
+
+static void lfu_sift_up(lfu_state_t *st, int i) {
+  while (i > 0 && lfu_less(st, st->heap[i], st->heap[(i - 1) / 2])) {
+    lfu_swap(st, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static int lfu_pop(lfu_state_t *st) {
+  int slot = st->heap[0];
+  lfu_swap(st, 0, --st->size);
+  lfu_sift_down(st, 0);
+  return slot;
+}
+
+static void lfu_push(lfu_state_t *st, int slot) {
+  st->heap[st->size] = slot;
+  st->pos[slot] = st->size++;
+  lfu_sift_up(st, st->pos[slot]);
+}
+
+static void lfu_insert(void *state, int slot, int key) {
+  lfu_state_t *st = state;
+  st->freq[slot] = 1;
+  st->last[slot] = ++st->tick;
+  lfu_push(st, slot);
+}
+
+static void lfu_touch(void *state, int slot) {
+  lfu_state_t *st = state;
+  st->freq[slot]++;
+  st->last[slot] = ++st->tick;
+  lfu_sift_down(st, st->pos[slot]);
+}
+
+static int lfu_evict(void *state, int key, cache_pinned_fn pinned, void *ctx) {
+  lfu_state_t *st = state;
+  int skipped = 0, victim = -1;
+
+  /* Pinned slots are popped out of the way and pushed back afterwards. Each
+   * pop parks the slot just past the end of the heap, so they sit (in
+   * reverse) after the victim. */
+  while (st->size > 0) {
+    int slot = lfu_pop(st);
+    if (!pinned(ctx, slot)) {
+      victim = slot;
+      break;
+    }
+    skipped++;
+  }
+  int parked = st->size + (victim != -1);
+  for (int i = 0; i < skipped; i++)
+    lfu_push(st, st->heap[parked + i]);
+  return victim;
+}
+
+/* The victim kept its count and last access, so pushing it back puts it
+ * where it was in the order. */
+static void lfu_restore(void *state, int slot) {
+  lfu_push(state, slot);
+}
+
+static int lfu_order(void *state, int *slots) {
+  lfu_state_t *st = state;
+  int n = st->size;
+
+  /* Popping every slot sorts them; a sorted array is a valid heap, so
+   * putting them back in that order restores the policy. */
+  for (int i = 0; i < n; i++)
+    slots[i] = lfu_pop(st);
+  for (int i = 0; i < n; i++) {
+    st->heap[i] = slots[i];
+    st->pos[slots[i]] = i;
+  }
+  st->size = n;
+  return n;
+}
+
+static const struct cache_policy_ops policies[CACHE_NUM_POLICIES] = {
+  [CACHE_POLICY_LRU] = {
+    "lru", lru_create, free, lru_insert, lru_touch, lru_evict, lru_restore,
+    lru_order,
+  },
+  [CACHE_POLICY_CLOCK] = {
+    "clock", clock_create, free, clock_insert, clock_touch, clock_evict,
+    clock_restore, clock_order,
+  },
+  [CACHE_POLICY_2Q] = {
+    "2q", twoq_create, twoq_destroy, twoq_insert, twoq_touch, twoq_evict,
+    twoq_restore, twoq_order,
+  },
+  [CACHE_POLICY_ARC] = {
+    "arc", arc_create, arc_destroy, arc_insert, arc_touch, arc_evict,
+    arc_restore, arc_order,
+  },
+  [CACHE_POLICY_LFU] = {
+    "lfu", lfu_create, lfu_destroy, lfu_insert, lfu_touch, lfu_evict,
+    lfu_restore, lfu_order,
+  },
+};
+
+const struct cache_policy_ops *cache_policy_lookup(cache_policy_t policy) {
+  if (policy < 0 || policy >= CACHE_NUM_POLICIES)
+    return NULL;
+  return &policies[policy];
+}
@@ -0,0 +1,49 @@
+#ifndef CACHE_POLICY_H_
+#define CACHE_POLICY_H_
+
+#include "cache.h"
+
+/* Every block in the JBOD has a unique key in [0, CACHE_NUM_KEYS). Policies
+ * that remember evicted blocks (2Q, ARC) keep their ghost lists over keys. */
+#define CACHE_NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+
+/* Tells a policy whether |slot| is pinned and must not be evicted. */
+typedef bool (*cache_pinned_fn)(void *ctx, int slot);
+
+/* Eviction policy interface used by cache.c. The cache owns the slots and the
+ * key index; a policy only orders the slots it has been told about. Slots are
+ * numbered [0, num_entries). */
+struct cache_policy_ops {
+  const char *name;
+
+  /* Returns the policy state for a cache of |num_entries| slots, or NULL. */
+  void *(*create)(int num_entries);
+  void (*destroy)(void *state);
+
+  /* |slot| now holds the block with |key|. */
+  void (*insert)(void *state, int slot, int key);
+
+  /* The block in |slot| was accessed. */
+  void (*touch)(void *state, int slot);
+
+  /* The cache is full and needs room for |key|: picks a victim slot for which
+   * |pinned| returns false, forgets it and returns it. Returns -1 if every
+   * slot is pinned. */
+  int (*evict)(void *state, int key, cache_pinned_fn pinned, void *ctx);
+
+  /* Undoes the evict that just returned |slot|, with no other call in
+   * between, because the cache keeps the block after all: the policy is
+   * left as it was before that evict, ghosts and all. */
+  void (*restore)(void *state, int slot);
+
+  /* Stores the slots the policy has been told about in |slots|, in the
+   * order it would evict them if nothing were touched or pinned meanwhile,
+   * first victim first, and returns how many there are. Leaves the policy
+   * as it was. */
+  int (*order)(void *state, int *slots);
+};
+
+/* Returns the implementation of |policy|, or NULL if there is none. */
+const struct cache_policy_ops *cache_policy_lookup(cache_policy_t policy);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stddef.h>
+
+#include "keysearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEYSEARCH_X86 1
+#endif
+
+static int find_scalar(const uint16_t *keys, int n, uint16_t key) {
+  for (int i = 0; i < n; i++)
+    if (keys[i] == key)
+      return i;
+  return -1;
+}
+
+#ifdef KEYSEARCH_X86
+/* Compares 8 keys at a time; the movemask has two bits per matching key. */
+__attribute__((target("sse2")))
+static int find_sse2(const uint16_t *keys, int n, uint16_t key) {
+  __m128i needle = _mm_set1_epi16((short)key);
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(keys + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, needle));
+    if (mask)
+      return i + __builtin_ctz(mask) / 2;
+  }
+  int rest = find_scalar(keys + i, n - i, key);
+  return rest == -1 ? -1 : i + rest;
+}
+
+/* Same as find_sse2 with 16 keys per compare. The 8-key step for the tail is
+ * repeated here rather than calling find_sse2, so it is VEX encoded too and
+ * the CPU never pays for switching between SSE and AVX state. */
+__attribute__((target("avx2")))
+static int find_avx2(const uint16_t *keys, int n, uint16_t key) {
+  __m256i needle = _mm256_set1_epi16((short)key);
+  int i = 0, found = -1;
+
+  for (; i + 16 <= n && found == -1; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, needle));
+    if (mask)
+      found = i + __builtin_ctz(mask) / 2;
+  }
+  if (found == -1 && i + 8 <= n) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(keys + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm256_castsi256_si128(needle)));
+    if (mask)
+      found = i + __builtin_ctz(mask) / 2;
+    i += 8;
+  }
+  _mm256_zeroupper();
+  for (; i < n && found == -1; i++)
+    if (keys[i] == key)
+      found = i;
+  return found;
+}
+#endif
+
+typedef int (*find_fn)(const uint16_t *keys, int n, uint16_t key);
+
+static const struct {
+  const char *name;
+  find_fn find;
+} impls[KEYSEARCH_NUM_IMPLS] = {
+  [KEYSEARCH_SCALAR] = { "scalar", find_scalar },
+#ifdef KEYSEARCH_X86
+  [KEYSEARCH_SSE2] = { "sse2", find_sse2 },
+  [KEYSEARCH_AVX2] = { "avx2", find_avx2 },
+#else
+  [KEYSEARCH_SSE2] = { "sse2", NULL },
+  [KEYSEARCH_AVX2] = { "avx2", NULL },
+#endif
+};
+
+static keysearch_impl_t selected = KEYSEARCH_SCALAR;
+
+int keysearch_supported(keysearch_impl_t impl) {
+  if (impl < 0 || impl >= KEYSEARCH_NUM_IMPLS || impls[impl].find == NULL)
+    return 0;
+#ifdef KEYSEARCH_X86
+  /* CPUID, including the OS support check for the AVX state. */
+  __builtin_cpu_init();
+  if (impl == KEYSEARCH_SSE2)
+    return __builtin_cpu_supports("sse2");
+  if (impl == KEYSEARCH_AVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return 1;
+}
+
+/* Picks the fastest supported implementation before main runs, so the hot
+ * path is a plain indirect call with no checks. */
+__attribute__((constructor))
+static void keysearch_init(void) {
+  for (int i = KEYSEARCH_NUM_IMPLS - 1; i >= 0; i--) {
+    if (keysearch_supported(i)) {
+      selected = i;
+      return;
+    }
+  }
+}
+
+int keysearch_find(const uint16_t *keys, int n, uint16_t key) {
+  return impls[selected].find(keys, n, key);
+}
+
+int keysearch_select(keysearch_impl_t impl) {
+  if (!keysearch_supported(impl))
+    return -1;
+  selected = impl;
+  return 1;
+}
+
+keysearch_impl_t keysearch_selected(void) { return selected; }
+
+const char *keysearch_impl_name(keysearch_impl_t impl) {
+  if (impl < 0 || impl >= KEYSEARCH_NUM_IMPLS)
+    return NULL;
+  return impls[impl].name;
+}
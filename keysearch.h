@@ -0,0 +1,32 @@
+#ifndef KEYSEARCH_H_
+#define KEYSEARCH_H_
+
+#include <stdint.h>
+
+/* Implementations of the 16-bit key search, slowest to fastest. */
+typedef enum {
+  KEYSEARCH_SCALAR,
+  KEYSEARCH_SSE2,   /* 8 keys per compare */
+  KEYSEARCH_AVX2,   /* 16 keys per compare */
+  KEYSEARCH_NUM_IMPLS,
+} keysearch_impl_t;
+
+/* Returns the index of the first of the |n| keys at |keys| equal to |key|, or
+ * -1 if there is none. Uses the implementation picked by keysearch_select,
+ * by default the fastest one the CPU supports. */
+int keysearch_find(const uint16_t *keys, int n, uint16_t key);
+
+/* Returns true if the CPU can run |impl|. */
+int keysearch_supported(keysearch_impl_t impl);
+
+/* Returns 1 on success and -1 on failure. Makes keysearch_find use |impl|,
+ * which fails if the CPU does not support it. Not thread-safe. */
+int keysearch_select(keysearch_impl_t impl);
+
+/* Returns the implementation keysearch_find currently uses. */
+keysearch_impl_t keysearch_selected(void);
+
+/* Returns the short name of |impl| ("scalar", "sse2", "avx2"). */
+const char *keysearch_impl_name(keysearch_impl_t impl);
+
+#endif
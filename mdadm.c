@@ -1,22 +1,811 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "mdadm.h"
 #include "jbod.h"
 
+#define MDADM_MAX_IO_SIZE 1024
+#define MDADM_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+#define MDADM_NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+/* Most blocks a single mdadm_read or mdadm_write can touch. */
+#define MDADM_MAX_BLOCKS (MDADM_MAX_IO_SIZE / JBOD_BLOCK_SIZE + 1)
+
+static int is_mounted = 0;
+
+/* mdadm may be called from several threads once mounted. Locks are always
+ * taken in this order: ra_lock, block locks (ascending), then the cache's
+ * shard locks and finally jbod_lock.
+ *
+ * jbod_lock makes a seek and the command that follows it atomic, and guards
+ * the shadow head and the command counters. */
+static pthread_mutex_t jbod_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Striped locks serialising I/O on a block: a miss reading a block from JBOD
+ * and caching it must not race a write of that block, and neither may two
+ * read-modify-writes. Consecutive blocks map to different stripes. */
+#define MDADM_NUM_BLOCK_LOCKS 64
+static pthread_mutex_t block_locks[MDADM_NUM_BLOCK_LOCKS] = {
+  [0 ... MDADM_NUM_BLOCK_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* Guards the read-ahead state below. */
+static pthread_mutex_t ra_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Shadow of the JBOD head position, -1 when unknown. JBOD resets it to block
+ * 0 on mount and on every disk seek, and advances the block after each read
+ * or write, so seeks to where the head already is can be skipped. */
+static int head_disk = -1;
+static int head_block = -1;
+
+/* Commands issued to JBOD, by jbod_cmd_t, and what JBOD charges for each;
+ * the costs mirror JBOD's own cost table. */
+static uint64_t cmd_counts[JBOD_NUM_CMDS];
+static const uint64_t cmd_costs[JBOD_NUM_CMDS] = {
+  [JBOD_MOUNT] = 1000,
+  [JBOD_UNMOUNT] = 1000,
+  [JBOD_SEEK_TO_DISK] = 500,
+  [JBOD_SEEK_TO_BLOCK] = 50,
+  [JBOD_READ_BLOCK] = 100,
+  [JBOD_WRITE_BLOCK] = 200,
+};
+static const char *const cmd_names[JBOD_NUM_CMDS] = {
+  [JBOD_MOUNT] = "mount",
+  [JBOD_UNMOUNT] = "unmount",
+  [JBOD_SEEK_TO_DISK] = "seek_to_disk",
+  [JBOD_SEEK_TO_BLOCK] = "seek_to_block",
+  [JBOD_READ_BLOCK] = "read_block",
+  [JBOD_WRITE_BLOCK] = "write_block",
+};
+
+/* Writes issued to each block, for the stamps cache_save and cache_load
+ * validate snapshots with; guarded by jbod_lock. JBOD keeps its drives in
+ * memory, so the stamps also carry an epoch drawn once per process, which
+ * keeps a snapshot from another process from looking current. Writes made
+ * to JBOD behind mdadm's back are not seen. */
+static uint32_t block_versions[MDADM_NUM_BLOCKS];
+static uint32_t volume_epoch = 0;
+
+/* Latency of mdadm_read and mdadm_write calls. */
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static mdadm_latency_t read_latency;
+static mdadm_latency_t write_latency;
+
+/* Read-ahead. A stream is a run of mdadm_read calls each starting where
+ * the previous one ended, or in the block right after; a single read over
+ * several blocks is not one. Every miss inside a stream doubles the window,
+ * starting at RA_MIN_WINDOW, and prefetches that many following blocks.
+ * Every prefetched block found evicted before it was read halves it, so a
+ * stream the cache cannot hold ends up prefetching nothing. */
+#define RA_MIN_WINDOW 4
+static int ra_max_window = 0;
+static int ra_window = 0;
+static int ra_end = -1;  /* address the previous mdadm_read ended at */
+static bool ra_pending[MDADM_NUM_BLOCKS];  /* prefetched, not yet read */
+static mdadm_readahead_stats_t ra_stats;
+
+/* Encodes a JBOD command: bits 26-31 hold the command, 22-25 the disk and
+ * 0-7 the block. */
+static uint32_t jbod_op(jbod_cmd_t cmd, int disk_num, int block_num) {
+  return (uint32_t)cmd << 26 | (uint32_t)disk_num << 22 | (uint32_t)block_num;
+}
+
+/* Issues |cmd| with its |disk_num|/|block_num| arguments (0 where the
+ * command takes none) and keeps the shadow head in sync with its effect.
+ * Every JBOD command goes through here. */
+static int jbod_issue(jbod_cmd_t cmd, int disk_num, int block_num, uint8_t *block) {
+  if (jbod_operation(jbod_op(cmd, disk_num, block_num), block) == -1) {
+    head_disk = head_block = -1;
+    return -1;
+  }
+  switch (cmd) {
+    case JBOD_MOUNT:
+      head_disk = head_block = 0;
+      break;
+    case JBOD_UNMOUNT:
+      head_disk = head_block = -1;
+      break;
+    case JBOD_SEEK_TO_DISK:
+      head_disk = disk_num;
+      head_block = 0;
+      break;
+    case JBOD_SEEK_TO_BLOCK:
+      head_block = block_num;
+      break;
+    case JBOD_WRITE_BLOCK:
+      block_versions[head_disk * JBOD_NUM_BLOCKS_PER_DISK + head_block]++;
+      head_block++;
+      break;
+    case JBOD_READ_BLOCK:
+      head_block++;
+      break;
+    default:
+      break;
+  }
+  cmd_counts[cmd]++;
+  return 0;
+}
+
+/* Positions the head at |disk_num|/|block_num|, skipping redundant seeks. */
+static int seek(int disk_num, int block_num) {
+  if (head_disk != disk_num &&
+      jbod_issue(JBOD_SEEK_TO_DISK, disk_num, 0, NULL) == -1)
+    return -1;
+  if (head_block != block_num &&
+      jbod_issue(JBOD_SEEK_TO_BLOCK, 0, block_num, NULL) == -1)
+    return -1;
+  return 0;
+}
+
+static int jbod_read(int disk_num, int block_num, uint8_t *buf) {
+  int rc = -1;
+
+  pthread_mutex_lock(&jbod_lock);
+  if (seek(disk_num, block_num) == 0)
+    rc = jbod_issue(JBOD_READ_BLOCK, 0, 0, buf);
+  pthread_mutex_unlock(&jbod_lock);
+  return rc;
+}
+
+static int jbod_write(int disk_num, int block_num, const uint8_t *buf) {
+  int rc = -1;
+
+  pthread_mutex_lock(&jbod_lock);
+  if (seek(disk_num, block_num) == 0)
+    rc = jbod_issue(JBOD_WRITE_BLOCK, 0, 0, (uint8_t *)buf);
+  pthread_mutex_unlock(&jbod_lock);
+  return rc;
+}
+
+/* One block transfer of a batch; |block| is a linear block number. */
+typedef struct {
+  uint16_t block;
+  uint8_t *buf;
+} jbod_io_t;
+
+/* The JBOD transfers of one request, all of the same command. The caller
+ * provides room for every transfer in |ios|. */
+typedef struct {
+  jbod_cmd_t cmd;  /* JBOD_READ_BLOCK or JBOD_WRITE_BLOCK */
+  int count;
+  jbod_io_t *ios;
+} jbod_batch_t;
+
+static void batch_add(jbod_batch_t *batch, int block, uint8_t *buf) {
+  batch->ios[batch->count++] = (jbod_io_t){ block, buf };
+}
+
+/* Issues every transfer of |batch| under a single hold of jbod_lock. The
+ * transfers are sorted by block, so runs of consecutive blocks need no seek
+ * at all, and the sweep starts at the first block at or after the head,
+ * wrapping around to the lower ones. A block read twice is read once and
+ * copied; of several writes to a block only the last one added is issued.
+ * Returns 0 on success and -1 on failure. */
+static int batch_submit(jbod_batch_t *batch) {
+  jbod_io_t *ios = batch->ios;
+  int n = batch->count, start = 0, rc = 0;
+
+  /* Insertion sort: batches are small and it keeps equal blocks in the
+   * order they were added. */
+  for (int i = 1; i < n; i++) {
+    jbod_io_t io = ios[i];
+    int j = i;
+    for (; j > 0 && ios[j - 1].block > io.block; j--)
+      ios[j] = ios[j - 1];
+    ios[j] = io;
+  }
+
+  pthread_mutex_lock(&jbod_lock);
+  int head = head_disk * JBOD_NUM_BLOCKS_PER_DISK + head_block;
+  while (head_disk != -1 && start < n && ios[start].block < head)
+    start++;
+  for (int k = 0; k < n && rc == 0; k++) {
+    int i = (start + k) % n;
+    int prev = (i + n - 1) % n, next = (i + 1) % n;
+    if (batch->cmd == JBOD_READ_BLOCK && i > 0 && ios[prev].block == ios[i].block) {
+      memcpy(ios[i].buf, ios[prev].buf, JBOD_BLOCK_SIZE);
+      continue;
+    }
+    if (batch->cmd == JBOD_WRITE_BLOCK && i < n - 1 && ios[next].block == ios[i].block)
+      continue;
+    rc = seek(ios[i].block / JBOD_NUM_BLOCKS_PER_DISK,
+              ios[i].block % JBOD_NUM_BLOCKS_PER_DISK);
+    if (rc == 0)
+      rc = jbod_issue(batch->cmd, 0, 0, ios[i].buf);
+  }
+  pthread_mutex_unlock(&jbod_lock);
+  return rc;
+}
+
+static void lock_block(int disk_num, int block_num) {
+  int b = disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num;
+  pthread_mutex_lock(&block_locks[b % MDADM_NUM_BLOCK_LOCKS]);
+}
+
+static void unlock_block(int disk_num, int block_num) {
+  int b = disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num;
+  pthread_mutex_unlock(&block_locks[b % MDADM_NUM_BLOCK_LOCKS]);
+}
+
+/* Counts a prefetched block that was evicted before it was read. */
+static void ra_wasted(void) {
+  ra_stats.wasted++;
+  ra_window /= 2;
+  if (ra_window < RA_MIN_WINDOW)
+    ra_window = 0;
+}
+
+/* Accounts a user read of linear block |b|, which |hit| the cache or not. */
+static void ra_account(int b, bool hit) {
+  if (!ra_pending[b])
+    return;
+  ra_pending[b] = false;
+  if (hit)
+    ra_stats.used++;
+  else
+    ra_wasted();
+}
+
+/* Called with ra_lock held right after a miss on |disk_num|/|block_num| was
+ * read from JBOD, with the head normally on the next block. Prefetches the
+ * window that follows while the blocks are uncached and on the same disk, so
+ * no seek is issued unless another thread moved the head in between. */
+static void ra_prefetch(int disk_num, int block_num) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  int limit = ra_max_window;
+
+  if (cache_capacity() / 2 < limit)
+    limit = cache_capacity() / 2;
+  ra_window = ra_window ? ra_window * 2 : RA_MIN_WINDOW;
+  if (ra_window > limit)
+    ra_window = limit;
+
+  for (int i = 1; i <= ra_window; i++) {
+    int b = block_num + i;
+    if (b >= JBOD_NUM_BLOCKS_PER_DISK)
+      break;
+    lock_block(disk_num, b);
+    bool fetched = !cache_contains(disk_num, b) &&
+                   jbod_read(disk_num, b, block) == 0 &&
+                   cache_insert(disk_num, b, block) == 1;
+    unlock_block(disk_num, b);
+    if (!fetched)
+      break;
+    int lb = disk_num * JBOD_NUM_BLOCKS_PER_DISK + b;
+    if (ra_pending[lb])
+      ra_wasted();
+    ra_pending[lb] = true;
+    ra_stats.issued++;
+  }
+}
+
+void mdadm_set_readahead(int max_blocks) {
+  pthread_mutex_lock(&ra_lock);
+  ra_max_window = max_blocks > 0 ? max_blocks : 0;
+  ra_window = 0;
+  ra_end = -1;
+  pthread_mutex_unlock(&ra_lock);
+}
+
+void mdadm_readahead_stats(mdadm_readahead_stats_t *stats) {
+  pthread_mutex_lock(&ra_lock);
+  *stats = ra_stats;
+  pthread_mutex_unlock(&ra_lock);
+}
+
+void mdadm_seek_stats(mdadm_seek_stats_t *stats) {
+  pthread_mutex_lock(&jbod_lock);
+  stats->disk = cmd_counts[JBOD_SEEK_TO_DISK];
+  stats->block = cmd_counts[JBOD_SEEK_TO_BLOCK];
+  pthread_mutex_unlock(&jbod_lock);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Records a call that started at |start| (from now_ns) in |latency|. */
+static void record_latency(mdadm_latency_t *latency, uint64_t start) {
+  uint64_t ns = now_ns() - start;
+  int bucket = ns > 0 ? 63 - __builtin_clzll(ns) : 0;
+
+  if (bucket >= MDADM_LATENCY_BUCKETS)
+    bucket = MDADM_LATENCY_BUCKETS - 1;
+  pthread_mutex_lock(&latency_lock);
+  latency->count++;
+  latency->total_ns += ns;
+  if (ns > latency->max_ns)
+    latency->max_ns = ns;
+  latency->buckets[bucket]++;
+  pthread_mutex_unlock(&latency_lock);
+}
+
+void mdadm_stats(mdadm_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  pthread_mutex_lock(&jbod_lock);
+  for (int i = 0; i < JBOD_NUM_CMDS; i++) {
+    stats->commands[i] = cmd_counts[i];
+    stats->cost[i] = cmd_counts[i] * cmd_costs[i];
+    stats->total_cost += stats->cost[i];
+  }
+  pthread_mutex_unlock(&jbod_lock);
+  pthread_mutex_lock(&latency_lock);
+  stats->read = read_latency;
+  stats->write = write_latency;
+  pthread_mutex_unlock(&latency_lock);
+  cache_get_stats(&stats->cache);
+  mdadm_readahead_stats(&stats->readahead);
+}
+
+void mdadm_stats_reset(void) {
+  pthread_mutex_lock(&ra_lock);
+  memset(&ra_stats, 0, sizeof(ra_stats));
+  pthread_mutex_unlock(&ra_lock);
+  pthread_mutex_lock(&jbod_lock);
+  memset(cmd_counts, 0, sizeof(cmd_counts));
+  pthread_mutex_unlock(&jbod_lock);
+  pthread_mutex_lock(&latency_lock);
+  memset(&read_latency, 0, sizeof(read_latency));
+  memset(&write_latency, 0, sizeof(write_latency));
+  pthread_mutex_unlock(&latency_lock);
+}
+
+static void print_latency_json(FILE *f, const char *name,
+                               const mdadm_latency_t *latency) {
+  fprintf(f, "  \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, "
+          "\"buckets\": [", name, (unsigned long long)latency->count,
+          (unsigned long long)latency->total_ns,
+          (unsigned long long)latency->max_ns);
+  for (int i = 0; i < MDADM_LATENCY_BUCKETS; i++)
+    fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)latency->buckets[i]);
+  fprintf(f, "]},\n");
+}
+
+int mdadm_stats_json(FILE *f) {
+  mdadm_stats_t stats;
+
+  if (f == NULL)
+    return -1;
+  mdadm_stats(&stats);
+  fprintf(f, "{\n  \"jbod\": {");
+  for (int i = 0; i < JBOD_NUM_CMDS; i++) {
+    if (cmd_names[i] != NULL)
+      fprintf(f, "\"%s\": {\"count\": %llu, \"cost\": %llu}, ", cmd_names[i],
+              (unsigned long long)stats.commands[i],
+              (unsigned long long)stats.cost[i]);
+  }
+  fprintf(f, "\"total_cost\": %llu},\n", (unsigned long long)stats.total_cost);
+  print_latency_json(f, "read", &stats.read);
+  print_latency_json(f, "write", &stats.write);
+  fprintf(f, "  \"cache\": {\"queries\": %llu, \"hits\": %llu, \"misses\": %llu, "
+          "\"inserts\": %llu, \"evictions\": %llu, \"write_backs\": %llu, "
+          "\"half_size_hits\": %llu, \"double_size_hits\": %llu, \"rejections\": %llu},\n",
+          (unsigned long long)stats.cache.queries,
+          (unsigned long long)stats.cache.hits,
+          (unsigned long long)stats.cache.misses,
+          (unsigned long long)stats.cache.inserts,
+          (unsigned long long)stats.cache.evictions,
+          (unsigned long long)stats.cache.write_backs,
+          (unsigned long long)stats.cache.half_size_hits,
+          (unsigned long long)stats.cache.double_size_hits,
+          (unsigned long long)stats.cache.rejections);
+  fprintf(f, "  \"readahead\": {\"issued\": %llu, \"used\": %llu, \"wasted\": %llu}\n}\n",
+          (unsigned long long)stats.readahead.issued,
+          (unsigned long long)stats.readahead.used,
+          (unsigned long long)stats.readahead.wasted);
+  return ferror(f) ? -1 : 1;
+}
+
+/* Stamp of the contents of a block, for cache snapshots. */
+static uint64_t block_stamp(int disk_num, int block_num) {
+  pthread_mutex_lock(&jbod_lock);
+  uint64_t stamp = (uint64_t)volume_epoch << 32 |
+                   block_versions[disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num];
+  pthread_mutex_unlock(&jbod_lock);
+  return stamp;
+}
+
+/* Write-back target for dirty cache entries. */
+static int write_back_block(int disk_num, int block_num, const uint8_t *buf) {
+  return jbod_write(disk_num, block_num, buf) == -1 ? -1 : 1;
+}
+
+/* A write-back cache writes a dirty block back when it evicts it, by which
+ * time the head has usually moved to another disk. Instead, whenever the
+ * head is on a disk, the dirty blocks there that the next CLEAN_AHEAD
+ * inserts could evict are written back in one sorted batch, costing no disk
+ * seek. A block spends that many inserts near eviction, during which the
+ * head visits every disk several times, so it is almost always clean by
+ * the time it is evicted. */
+#define CLEAN_AHEAD 128
+
+/* Writes blocks a write-back cache cleans ahead of eviction in one batch. */
+static int clean_blocks(int count, const int *blocks, const uint8_t *const *bufs) {
+  jbod_io_t ios[count];
+  jbod_batch_t batch = { JBOD_WRITE_BLOCK, 0, ios };
+
+  for (int i = 0; i < count; i++)
+    batch_add(&batch, blocks[i], (uint8_t *)bufs[i]);
+  return batch_submit(&batch) == -1 ? -1 : 1;
+}
+
+/* Cleans the dirty blocks on the disk under the head that are near
+ * eviction (see CLEAN_AHEAD). */
+static int clean_ahead(void) {
+  if (!cache_enabled() || !cache_write_back())
+    return 0;
+  pthread_mutex_lock(&jbod_lock);
+  int disk_num = head_disk;
+  pthread_mutex_unlock(&jbod_lock);
+  if (disk_num == -1)
+    return 0;
+  return cache_clean_ahead(disk_num, CLEAN_AHEAD, clean_blocks) == -1 ? -1 : 0;
+}
+
+/* Locks every block in |blocks|, in ascending lock order. Returns the set
+ * of locks taken, for unlock_blocks. */
+static uint64_t lock_blocks(const uint16_t *blocks, int n) {
+  uint64_t mask = 0;
+
+  for (int i = 0; i < n; i++)
+    mask |= (uint64_t)1 << (blocks[i] % MDADM_NUM_BLOCK_LOCKS);
+  for (int i = 0; i < MDADM_NUM_BLOCK_LOCKS; i++)
+    if (mask & (uint64_t)1 << i)
+      pthread_mutex_lock(&block_locks[i]);
+  return mask;
+}
+
+static void unlock_blocks(uint64_t mask) {
+  for (int i = MDADM_NUM_BLOCK_LOCKS - 1; i >= 0; i--)
+    if (mask & (uint64_t)1 << i)
+      pthread_mutex_unlock(&block_locks[i]);
+}
+
+/* Loads the |n| distinct, ascending, locked blocks in |blocks| into |data|:
+ * from the cache where possible, the rest from JBOD in one batch, after
+ * which the cache is cleaned ahead and they are cached. With |missed| the blocks just missed the cache, so
+ * only those another thread has cached since are looked up again (possibly a
+ * newer dirty copy). Blocks flagged in |skip|, if not NULL, are about to be
+ * overwritten completely and are not loaded. Returns 0 on success and -1 on
+ * failure. */
+static int load_blocks(const uint16_t *blocks, uint8_t (*data)[JBOD_BLOCK_SIZE],
+                       int n, bool missed, const bool *skip) {
+  jbod_io_t ios[n > 0 ? n : 1];
+  jbod_batch_t batch = { JBOD_READ_BLOCK, 0, ios };
+
+  for (int i = 0; i < n; i++) {
+    if (skip != NULL && skip[i])
+      continue;
+    int disk_num = blocks[i] / JBOD_NUM_BLOCKS_PER_DISK;
+    int block_num = blocks[i] % JBOD_NUM_BLOCKS_PER_DISK;
+    if (!cache_enabled() || (missed && !cache_contains(disk_num, block_num)) ||
+        cache_lookup(disk_num, block_num, data[i]) != 1)
+      batch_add(&batch, blocks[i], data[i]);
+  }
+  if (batch_submit(&batch) == -1 || clean_ahead() == -1)
+    return -1;
+  for (int i = 0; cache_enabled() && i < batch.count; i++)
+    cache_insert(ios[i].block / JBOD_NUM_BLOCKS_PER_DISK,
+                 ios[i].block % JBOD_NUM_BLOCKS_PER_DISK, ios[i].buf);
+  return 0;
+}
+
+/* Stores the |n| distinct, locked blocks in |blocks| from |data|. A
+ * write-back cache absorbs them and is cleaned ahead; otherwise they go to
+ * JBOD in one batch and are then cached, updating the cached copies of those
+ * already there. Returns 0 on success and -1 on failure. */
+static int store_blocks(const uint16_t *blocks, uint8_t (*data)[JBOD_BLOCK_SIZE], int n) {
+  jbod_io_t ios[n > 0 ? n : 1];
+  jbod_batch_t batch = { JBOD_WRITE_BLOCK, 0, ios };
+
+  for (int i = 0; i < n; i++) {
+    int disk_num = blocks[i] / JBOD_NUM_BLOCKS_PER_DISK;
+    int block_num = blocks[i] % JBOD_NUM_BLOCKS_PER_DISK;
+    if (cache_enabled() && cache_write_back()) {
+      if (cache_write(disk_num, block_num, data[i]) != 1)
+        return -1;
+    } else {
+      batch_add(&batch, blocks[i], data[i]);
+    }
+  }
+  if (batch_submit(&batch) == -1 || clean_ahead() == -1)
+    return -1;
+  for (int i = 0; cache_enabled() && i < batch.count; i++) {
+    int disk_num = ios[i].block / JBOD_NUM_BLOCKS_PER_DISK;
+    int block_num = ios[i].block % JBOD_NUM_BLOCKS_PER_DISK;
+    if (cache_insert(disk_num, block_num, ios[i].buf) == -1)
+      cache_update(disk_num, block_num, ios[i].buf);
+  }
+  return 0;
+}
+
+/* Copies between the part of block |b| that the range |addr|/|len| covers
+ * and |block|, in the direction given by |to_block|. */
+static void copy_piece(uint32_t addr, uint32_t len, uint8_t *buf, int b,
+                       uint8_t *block, bool to_block) {
+  uint32_t start = b * JBOD_BLOCK_SIZE, end = start + JBOD_BLOCK_SIZE;
+
+  if (start < addr)
+    start = addr;
+  if (end > addr + len)
+    end = addr + len;
+  if (to_block)
+    memcpy(block + start % JBOD_BLOCK_SIZE, buf + (start - addr), end - start);
+  else
+    memcpy(buf + (start - addr), block + start % JBOD_BLOCK_SIZE, end - start);
+}
+
+static bool valid_io(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  if (!is_mounted)
+    return false;
+  if (len > MDADM_MAX_IO_SIZE)
+    return false;
+  if (addr >= MDADM_SIZE || len > MDADM_SIZE - addr)
+    return false;
+  return len == 0 || buf != NULL;
+}
+
 int mdadm_mount(void) {
-  return -1;
+  if (is_mounted)
+    return -1;
+  if (jbod_issue(JBOD_MOUNT, 0, 0, NULL) == -1)
+    return -1;
+  is_mounted = 1;
+  cache_set_writeback(write_back_block);
+  /* The stamps stay valid while unmounted, since nothing writes then, so a
+   * cache can be saved after mdadm_unmount. */
+  pthread_mutex_lock(&jbod_lock);
+  while (volume_epoch == 0)
+    volume_epoch = now_ns() ^ now_ns() >> 32;
+  pthread_mutex_unlock(&jbod_lock);
+  cache_set_stamp(block_stamp);
+  return 1;
 }
 
 int mdadm_unmount(void) {
-  return -1;
+  if (!is_mounted)
+    return -1;
+  if (cache_enabled() && cache_flush() == -1)
+    return -1;
+  cache_set_writeback(NULL);
+  if (jbod_issue(JBOD_UNMOUNT, 0, 0, NULL) == -1)
+    return -1;
+  is_mounted = 0;
+  return 1;
 }
 
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+static int read_range(uint32_t addr, uint32_t len, uint8_t *buf) {
+  uint16_t missed[MDADM_MAX_BLOCKS];
+  uint8_t data[MDADM_MAX_BLOCKS][JBOD_BLOCK_SIZE];
+  bool hit[MDADM_MAX_BLOCKS];
+  int num_missed = 0;
+  bool sequential = false;
+
+  if (!valid_io(addr, len, buf))
+    return -1;
+  if (len == 0)
+    return 0;
+
+  int first = addr / JBOD_BLOCK_SIZE, last = (addr + len - 1) / JBOD_BLOCK_SIZE;
+  for (int b = first; b <= last; b++) {
+    int disk_num = b / JBOD_NUM_BLOCKS_PER_DISK;
+    int block_num = b % JBOD_NUM_BLOCKS_PER_DISK;
+
+    /* Hits are copied straight out of the cache slot. The pin keeps the
+     * slot from being evicted meanwhile, and the block lock keeps writes to
+     * the block from changing it mid-copy. */
+    const uint8_t *cached = NULL;
+    if (cache_enabled()) {
+      lock_block(disk_num, block_num);
+      cached = cache_get(disk_num, block_num);
+      if (cached != NULL) {
+        copy_piece(addr, len, buf, b, (uint8_t *)cached, false);
+        cache_put(disk_num, block_num);
+      }
+      unlock_block(disk_num, block_num);
+    }
+    if (cached == NULL)
+      missed[num_missed++] = b;
+    hit[b - first] = cached != NULL;
+  }
+
+  bool readahead = ra_max_window > 0 && cache_enabled();
+  if (readahead) {
+    pthread_mutex_lock(&ra_lock);
+    sequential = ra_end != -1 &&
+                 (addr == ra_end || first == (ra_end - 1) / JBOD_BLOCK_SIZE + 1);
+    ra_end = addr + len;
+    for (int b = first; b <= last; b++)
+      ra_account(b, hit[b - first]);
+    pthread_mutex_unlock(&ra_lock);
+  }
+  if (num_missed == 0)
+    return len;
+
+  /* The misses are read from JBOD together. */
+  uint64_t locks = lock_blocks(missed, num_missed);
+  int rc = load_blocks(missed, data, num_missed, true, NULL);
+  unlock_blocks(locks);
+  if (rc == -1)
+    return -1;
+  for (int i = 0; i < num_missed; i++)
+    copy_piece(addr, len, buf, missed[i], data[i], false);
+
+  /* A miss continuing a stream prefetches what follows the last one. */
+  if (readahead) {
+    int last = missed[num_missed - 1];
+    pthread_mutex_lock(&ra_lock);
+    if (!sequential)
+      ra_window = 0;
+    else
+      ra_prefetch(last / JBOD_NUM_BLOCKS_PER_DISK, last % JBOD_NUM_BLOCKS_PER_DISK);
+    pthread_mutex_unlock(&ra_lock);
+  }
   return len;
 }
 
+static int write_range(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  uint16_t blocks[MDADM_MAX_BLOCKS];
+  uint8_t data[MDADM_MAX_BLOCKS][JBOD_BLOCK_SIZE];
+  int n = 0;
+
+  if (!valid_io(addr, len, buf))
+    return -1;
+  if (len == 0)
+    return 0;
+
+  for (int b = addr / JBOD_BLOCK_SIZE; b <= (addr + len - 1) / JBOD_BLOCK_SIZE; b++)
+    blocks[n++] = b;
+
+  /* Blocks the range covers completely are overwritten without being read;
+   * only a partially covered first or last block needs read-modify-write. */
+  bool full[MDADM_MAX_BLOCKS];
+  for (int i = 0; i < n; i++)
+    full[i] = true;
+  if (addr % JBOD_BLOCK_SIZE != 0)
+    full[0] = false;
+  if ((addr + len) % JBOD_BLOCK_SIZE != 0)
+    full[n - 1] = false;
+
+  uint64_t locks = lock_blocks(blocks, n);
+  int rc = load_blocks(blocks, data, n, false, full);
+  if (rc == 0) {
+    for (int i = 0; i < n; i++)
+      copy_piece(addr, len, (uint8_t *)buf, blocks[i], data[i], true);
+    rc = store_blocks(blocks, data, n);
+  }
+  unlock_blocks(locks);
+  return rc == -1 ? -1 : (int)len;
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+  uint64_t start = now_ns();
+  int rc = read_range(addr, len, buf);
+  record_latency(&read_latency, start);
+  return rc;
+}
+
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
-  return len;
+  uint64_t start = now_ns();
+  int rc = write_range(addr, len, buf);
+  record_latency(&write_latency, start);
+  return rc;
+}
+
+/* The distinct blocks touched by a vectored request. Blocks are numbered
+ * linearly (disk * JBOD_NUM_BLOCKS_PER_DISK + block), so ascending order is
+ * (disk, block) order. */
+typedef struct {
+  int count;
+  uint16_t *blocks;                  /* ascending */
+  int16_t index[MDADM_NUM_BLOCKS];   /* position in |blocks|, -1 if absent */
+  uint8_t (*data)[JBOD_BLOCK_SIZE];  /* contents, parallel to |blocks| */
+  bool *full;                        /* wholly covered by one range */
+  uint64_t locked;                   /* block locks held, one bit each */
+} block_set_t;
+
+/* Collects the blocks of all ranges in |iov|. Returns -1 if a range is
+ * invalid or memory runs out. */
+static int block_set_init(block_set_t *set, const mdadm_iovec_t *iov, int iovcnt) {
+  memset(set, 0, sizeof(*set));
+  memset(set->index, -1, sizeof(set->index));
+  for (int i = 0; i < iovcnt; i++) {
+    if (!valid_io(iov[i].addr, iov[i].len, iov[i].buf))
+      return -1;
+    if (iov[i].len == 0)
+      continue;
+    uint32_t first = iov[i].addr / JBOD_BLOCK_SIZE;
+    uint32_t last = (iov[i].addr + iov[i].len - 1) / JBOD_BLOCK_SIZE;
+    for (uint32_t b = first; b <= last; b++) {
+      /* Numbered below, once all ranges are in; until then 1 marks a block
+       * some range covers completely. */
+      if (set->index[b] == -1)
+        set->count++;
+      if (set->index[b] != 1)
+        set->index[b] = iov[i].addr <= b * JBOD_BLOCK_SIZE &&
+                        iov[i].addr + iov[i].len >= (b + 1) * JBOD_BLOCK_SIZE;
+    }
+  }
+
+  set->blocks = malloc(set->count * sizeof(uint16_t) + 1);
+  set->data = malloc(set->count * JBOD_BLOCK_SIZE + 1);
+  set->full = malloc(set->count * sizeof(bool) + 1);
+  if (set->blocks == NULL || set->data == NULL || set->full == NULL)
+    return -1;
+  for (int b = 0, n = 0; b < MDADM_NUM_BLOCKS; b++) {
+    if (set->index[b] != -1) {
+      set->full[n] = set->index[b];
+      set->index[b] = n;
+      set->blocks[n++] = b;
+    }
+  }
+  return 0;
+}
+
+static void block_set_free(block_set_t *set) {
+  unlock_blocks(set->locked);
+  free(set->blocks);
+  free(set->data);
+  free(set->full);
+}
+
+/* Locks every block of |set| until block_set_free, then loads them: cache
+ * hits first, then the misses from JBOD in one batch. With |for_write|,
+ * blocks that will be overwritten completely are not loaded. */
+static int block_set_load(block_set_t *set, bool for_write) {
+  set->locked = lock_blocks(set->blocks, set->count);
+  return load_blocks(set->blocks, set->data, set->count, false,
+                     for_write ? set->full : NULL);
+}
+
+/* Copies between the range |io| and the staged blocks of |set|. */
+static void block_set_copy(block_set_t *set, const mdadm_iovec_t *io, bool to_set) {
+  if (io->len == 0)
+    return;
+  for (int b = io->addr / JBOD_BLOCK_SIZE; b <= (io->addr + io->len - 1) / JBOD_BLOCK_SIZE; b++)
+    copy_piece(io->addr, io->len, io->buf, b, set->data[set->index[b]], to_set);
+}
+
+int mdadm_readv(const mdadm_iovec_t *iov, int iovcnt) {
+  block_set_t set;
+  int total = 0;
+
+  if (iovcnt < 0 || (iovcnt > 0 && iov == NULL))
+    return -1;
+  if (block_set_init(&set, iov, iovcnt) == -1 ||
+      block_set_load(&set, false) == -1) {
+    block_set_free(&set);
+    return -1;
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    block_set_copy(&set, &iov[i], false);
+    total += iov[i].len;
+  }
+  block_set_free(&set);
+  return total;
+}
+
+int mdadm_writev(const mdadm_iovec_t *iov, int iovcnt) {
+  block_set_t set;
+  int total = 0;
+
+  if (iovcnt < 0 || (iovcnt > 0 && iov == NULL))
+    return -1;
+  if (block_set_init(&set, iov, iovcnt) == -1 ||
+      block_set_load(&set, true) == -1) {
+    block_set_free(&set);
+    return -1;
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    block_set_copy(&set, &iov[i], true);
+    total += iov[i].len;
+  }
+  int rc = store_blocks(set.blocks, set.data, set.count);
+  block_set_free(&set);
+  return rc == -1 ? -1 : total;
 }
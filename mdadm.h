@@ -2,6 +2,7 @@
 #define MDADM_H_
 
 #include <stdint.h>
+#include <stdio.h>
 #include "jbod.h"
 #include "cache.h"
 
@@ -17,4 +18,82 @@ int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 /* Return the number of bytes written on success, -1 on failure. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* Read-ahead counters. A prefetched block is used if a read hits it in the
+ * cache, and wasted if it was evicted (or prefetched again) before that. */
+typedef struct {
+  uint64_t issued;
+  uint64_t used;
+  uint64_t wasted;
+} mdadm_readahead_stats_t;
+
+/* Enables sequential read-ahead into the cache with a window of up to
+ * |max_blocks| blocks (further bounded by half the cache capacity); 0
+ * disables it, which is the default. */
+void mdadm_set_readahead(int max_blocks);
+
+/* Copies the read-ahead counters into |stats|. */
+void mdadm_readahead_stats(mdadm_readahead_stats_t *stats);
+
+/* Seek commands issued to JBOD since startup. */
+typedef struct {
+  uint64_t disk;
+  uint64_t block;
+} mdadm_seek_stats_t;
+
+/* Copies the seek counters into |stats|. */
+void mdadm_seek_stats(mdadm_seek_stats_t *stats);
+
+/* Latency histogram of a call. Bucket i counts calls that took from 2^i up to
+ * 2^(i+1) nanoseconds, bucket 0 also shorter ones and the last bucket also
+ * longer ones. */
+#define MDADM_LATENCY_BUCKETS 32
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[MDADM_LATENCY_BUCKETS];
+} mdadm_latency_t;
+
+/* Everything mdadm counts. Commands and their cost are indexed by
+ * jbod_cmd_t and cover the commands mdadm issued to JBOD. */
+typedef struct {
+  uint64_t commands[JBOD_NUM_CMDS];
+  uint64_t cost[JBOD_NUM_CMDS];
+  uint64_t total_cost;
+  mdadm_latency_t read;   /* mdadm_read calls */
+  mdadm_latency_t write;  /* mdadm_write calls */
+  cache_stats_t cache;    /* see cache_get_stats */
+  mdadm_readahead_stats_t readahead;
+} mdadm_stats_t;
+
+/* Copies the current counters into |stats|. */
+void mdadm_stats(mdadm_stats_t *stats);
+
+/* Clears every counter but the cache's, which restart with the cache. */
+void mdadm_stats_reset(void);
+
+/* Returns 1 on success and -1 on failure. Writes the counters of
+ * mdadm_stats to |f| as a JSON object. */
+int mdadm_stats_json(FILE *f);
+
+/* One range of a vectored request: |len| bytes at linear address |addr|,
+ * transferred to or from |buf|. */
+typedef struct {
+  uint32_t addr;
+  uint32_t len;
+  void *buf;
+} mdadm_iovec_t;
+
+/* Reads |iovcnt| ranges, each subject to the same limits as mdadm_read.
+ * Blocks shared by several ranges are fetched once, cached blocks are served
+ * first and the rest are read from JBOD in (disk, block) order. Return the
+ * total number of bytes read on success, -1 on failure. */
+int mdadm_readv(const mdadm_iovec_t *iov, int iovcnt);
+
+/* Writes |iovcnt| ranges, each subject to the same limits as mdadm_write.
+ * Where ranges overlap, the later one wins. Every touched block is written
+ * once, in (disk, block) order. Return the total number of bytes written on
+ * success, -1 on failure. */
+int mdadm_writev(const mdadm_iovec_t *iov, int iovcnt);
+
 #endif
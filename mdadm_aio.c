@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mdadm_aio.h"
+#include "jbod.h"
+#include "mdadm.h"
+
+/* Requests are queued in submission order on a singly linked list, which the
+ * worker moves into |pending| whenever it is about to dispatch. It dispatches
+ * runs of reads or runs of writes; each run becomes a single mdadm_readv or
+ * mdadm_writev, which merges the blocks the requests share and sweeps JBOD
+ * once.
+ *
+ * With the FIFO scheduler a run is the oldest pending requests up to the
+ * first of the other kind. With C-LOOK the next request is the one starting
+ * at the lowest address at or after where the previous one started,
+ * wrapping to the lowest address when there is none, so the head moves in
+ * one direction across disks and blocks; the run goes on while the next
+ * pick is of the same kind. The cursor is the start rather than the end of
+ * the previous request so that requests overlapping it, whose blocks the
+ * head has just passed over, are served in this sweep instead of the next.
+ * A request is only picked once every older request it overlaps, where
+ * either writes, has been, so each request still sees the writes submitted
+ * before it. The oldest request is picked regardless once younger ones have
+ * overtaken it |starvation_bound| times. */
+
+enum { AIO_QUEUED, AIO_RUNNING, AIO_DONE };
+
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_submitted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t aio_completed = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static bool running = false;
+static bool stopping = false;
+static mdadm_aio_options_t aio_options;
+static int max_depth = 0;
+static int depth = 0;  /* requests submitted and not yet completed */
+static uint64_t next_seq = 0;
+static mdadm_aio_t *head = NULL, *tail = NULL;
+
+/* Worker state: requests taken off the queue, oldest first, and the run
+ * being dispatched, both with room for |max_depth| requests. */
+static mdadm_aio_t **pending, **run;
+static int num_pending = 0;
+static uint32_t cursor = 0;  /* where the last dispatched request started */
+
+static bool conflicts(const mdadm_aio_t *a, const mdadm_aio_t *b) {
+  return (a->write || b->write) &&
+         a->addr < b->addr + b->len && b->addr < a->addr + a->len;
+}
+
+/* Returns true if |next| may join the run ending with |last|. Runs stay on
+ * one disk: a run loads the blocks it only partly writes before writing any,
+ * so spanning disks would cross between them twice. */
+static bool mergeable(const mdadm_aio_t *last, const mdadm_aio_t *next) {
+  return next->write == last->write &&
+         next->addr / JBOD_DISK_SIZE ==
+             (last->addr + last->len - 1) / JBOD_DISK_SIZE;
+}
+
+/* Returns true if no older pending request must be dispatched before
+ * pending[i]. */
+static bool eligible(int i) {
+  for (int j = 0; j < i; j++)
+    if (conflicts(pending[j], pending[i]))
+      return false;
+  return true;
+}
+
+/* Returns the index in |pending| of the request to dispatch next. */
+static int pick(void) {
+  if (aio_options.scheduler == MDADM_SCHED_FIFO ||
+      pending[0]->passed >= aio_options.starvation_bound)
+    return 0;
+
+  int next = -1, lowest = -1;
+  for (int i = 0; i < num_pending; i++) {
+    uint32_t addr = pending[i]->addr;
+    bool ahead = addr >= cursor && (next == -1 || addr < pending[next]->addr);
+    bool low = lowest == -1 || addr < pending[lowest]->addr;
+    if ((ahead || low) && eligible(i)) {
+      if (ahead)
+        next = i;
+      if (low)
+        lowest = i;
+    }
+  }
+  return next != -1 ? next : lowest;
+}
+
+/* Removes pending[i], counting it overtaking every older request. */
+static mdadm_aio_t *take(int i) {
+  mdadm_aio_t *aio = pending[i];
+  for (int j = 0; j < i; j++)
+    pending[j]->passed++;
+  for (int j = i; j < num_pending - 1; j++)
+    pending[j] = pending[j + 1];
+  num_pending--;
+  cursor = aio->addr;
+  return aio;
+}
+
+/* Serves the |n| requests of the same kind in |run|, in submission order,
+ * with one vectored call. If that fails, one of the requests is invalid, so
+ * each is retried on its own to give every request its own result. */
+static void serve_run(int n) {
+  mdadm_iovec_t iov[n];
+
+  for (int i = 1; i < n; i++) {
+    mdadm_aio_t *aio = run[i];
+    int j = i;
+    for (; j > 0 && run[j - 1]->seq > aio->seq; j--)
+      run[j] = run[j - 1];
+    run[j] = aio;
+  }
+  for (int i = 0; i < n; i++)
+    iov[i] = (mdadm_iovec_t){ run[i]->addr, run[i]->len, run[i]->buf };
+  int rc = run[0]->write ? mdadm_writev(iov, n) : mdadm_readv(iov, n);
+
+  for (int i = 0; i < n; i++) {
+    mdadm_aio_t *aio = run[i];
+    if (rc != -1)
+      aio->result = aio->len;
+    else if (aio->write)
+      aio->result = mdadm_write(aio->addr, aio->len, aio->buf);
+    else
+      aio->result = mdadm_read(aio->addr, aio->len, aio->buf);
+  }
+}
+
+static void complete(mdadm_aio_t *aio) {
+  if (aio->done != NULL)
+    aio->done(aio);
+  pthread_mutex_lock(&aio_lock);
+  aio->state = AIO_DONE;
+  depth--;
+  pthread_cond_broadcast(&aio_completed);
+  pthread_mutex_unlock(&aio_lock);
+}
+
+static void *worker_main(void *unused) {
+  pthread_mutex_lock(&aio_lock);
+  for (;;) {
+    while (head == NULL && num_pending == 0 && !stopping)
+      pthread_cond_wait(&aio_submitted, &aio_lock);
+    if (head == NULL && num_pending == 0)
+      break;
+    for (mdadm_aio_t *aio = head; aio != NULL; aio = aio->next) {
+      aio->state = AIO_RUNNING;
+      pending[num_pending++] = aio;
+    }
+    head = tail = NULL;
+    pthread_mutex_unlock(&aio_lock);
+
+    int n = 0;
+    run[n++] = take(pick());
+    while (num_pending > 0) {
+      int i = pick();
+      if (!mergeable(run[n - 1], pending[i]))
+        break;
+      run[n++] = take(i);
+    }
+    serve_run(n);
+    /* Once completed a request may be reused, so only complete it here. */
+    for (int i = 0; i < n; i++)
+      complete(run[i]);
+    pthread_mutex_lock(&aio_lock);
+  }
+  pthread_mutex_unlock(&aio_lock);
+  return NULL;
+}
+
+int mdadm_aio_start(int queue_depth) {
+  return mdadm_aio_start_ex(queue_depth, NULL);
+}
+
+int mdadm_aio_start_ex(int queue_depth, const mdadm_aio_options_t *options) {
+  mdadm_aio_options_t defaults = { MDADM_SCHED_CLOOK, 64 };
+
+  if (options == NULL)
+    options = &defaults;
+  if (queue_depth < 1 || options->scheduler < MDADM_SCHED_FIFO ||
+      options->scheduler > MDADM_SCHED_CLOOK || options->starvation_bound < 0)
+    return -1;
+  pthread_mutex_lock(&aio_lock);
+  if (running) {
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+  pending = malloc(queue_depth * sizeof(*pending));
+  run = malloc(queue_depth * sizeof(*run));
+  if (pending == NULL || run == NULL) {
+    free(pending);
+    free(run);
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+  aio_options = *options;
+  max_depth = queue_depth;
+  num_pending = 0;
+  cursor = 0;
+  stopping = false;
+  running = pthread_create(&worker, NULL, worker_main, NULL) == 0;
+  if (!running) {
+    free(pending);
+    free(run);
+  }
+  pthread_mutex_unlock(&aio_lock);
+  return running ? 1 : -1;
+}
+
+int mdadm_aio_stop(void) {
+  pthread_mutex_lock(&aio_lock);
+  if (!running || stopping) {
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+  stopping = true;
+  pthread_cond_signal(&aio_submitted);
+  pthread_mutex_unlock(&aio_lock);
+  pthread_join(worker, NULL);
+  free(pending);
+  free(run);
+  /* Submitters keep seeing |stopping| until the worker is gone. */
+  pthread_mutex_lock(&aio_lock);
+  running = false;
+  stopping = false;
+  pthread_mutex_unlock(&aio_lock);
+  return 1;
+}
+
+static int submit(mdadm_aio_t *aio, bool write) {
+  if (aio == NULL)
+    return -1;
+  pthread_mutex_lock(&aio_lock);
+  while (running && !stopping && depth >= max_depth)
+    pthread_cond_wait(&aio_completed, &aio_lock);
+  if (!running || stopping) {
+    pthread_mutex_unlock(&aio_lock);
+    return -1;
+  }
+  aio->write = write;
+  aio->result = -1;
+  aio->state = AIO_QUEUED;
+  aio->next = NULL;
+  aio->seq = next_seq++;
+  aio->passed = 0;
+  if (tail != NULL)
+    tail->next = aio;
+  else
+    head = aio;
+  tail = aio;
+  depth++;
+  pthread_cond_signal(&aio_submitted);
+  pthread_mutex_unlock(&aio_lock);
+  return 1;
+}
+
+int mdadm_read_async(mdadm_aio_t *aio) { return submit(aio, false); }
+
+int mdadm_write_async(mdadm_aio_t *aio) { return submit(aio, true); }
+
+bool mdadm_aio_poll(mdadm_aio_t *aio) {
+  pthread_mutex_lock(&aio_lock);
+  bool done = aio->state == AIO_DONE;
+  pthread_mutex_unlock(&aio_lock);
+  return done;
+}
+
+int mdadm_aio_wait(mdadm_aio_t *aio) {
+  pthread_mutex_lock(&aio_lock);
+  while (aio->state != AIO_DONE)
+    pthread_cond_wait(&aio_completed, &aio_lock);
+  pthread_mutex_unlock(&aio_lock);
+  return aio->result;
+}
+
+void mdadm_aio_drain(void) {
+  pthread_mutex_lock(&aio_lock);
+  while (depth > 0)
+    pthread_cond_wait(&aio_completed, &aio_lock);
+  pthread_mutex_unlock(&aio_lock);
+}
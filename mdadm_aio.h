@@ -0,0 +1,71 @@
+#ifndef MDADM_AIO_H_
+#define MDADM_AIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* An asynchronous mdadm request. The caller owns it and fills in the public
+ * fields; it, and |buf|, must stay valid until the request completes. */
+typedef struct mdadm_aio {
+  uint32_t addr;
+  uint32_t len;
+  uint8_t *buf;
+  /* Called on the worker thread when the request is done, just before
+   * waiters see it complete, or NULL. It must not resubmit |aio|. */
+  void (*done)(struct mdadm_aio *aio);
+  void *arg;  /* for the caller's use */
+
+  /* Private. */
+  bool write;
+  int result;
+  int state;
+  uint64_t seq;  /* submission order */
+  int passed;    /* times younger requests were dispatched first */
+  struct mdadm_aio *next;
+} mdadm_aio_t;
+
+/* Orders in which the worker dispatches queued requests. */
+typedef enum {
+  MDADM_SCHED_FIFO,   /* submission order */
+  MDADM_SCHED_CLOOK,  /* ascending address, wrapping around (elevator) */
+} mdadm_sched_t;
+
+typedef struct {
+  mdadm_sched_t scheduler;
+  /* C-LOOK: how many times younger requests may be dispatched ahead of the
+   * oldest queued one before it goes next regardless. */
+  int starvation_bound;
+} mdadm_aio_options_t;
+
+/* Returns 1 on success and -1 on failure. Starts the worker thread that
+ * serves asynchronous requests, with room for |queue_depth| queued requests;
+ * submitting more blocks until one completes. */
+int mdadm_aio_start(int queue_depth);
+
+/* Same as mdadm_aio_start, with the scheduler chosen by |options|. A NULL
+ * |options| gives the defaults, which is C-LOOK with a starvation bound of
+ * 64; mdadm_aio_start uses those too. */
+int mdadm_aio_start_ex(int queue_depth, const mdadm_aio_options_t *options);
+
+/* Returns 1 on success and -1 on failure. Completes every queued request and
+ * stops the worker. */
+int mdadm_aio_stop(void);
+
+/* Returns 1 on success and -1 on failure. Queues a read of |aio->len| bytes
+ * at |aio->addr| into |aio->buf|. Its result, as mdadm_read would return it,
+ * is available from mdadm_aio_wait. */
+int mdadm_read_async(mdadm_aio_t *aio);
+
+/* Same as mdadm_read_async, for a write from |aio->buf|. */
+int mdadm_write_async(mdadm_aio_t *aio);
+
+/* Returns true if |aio| has completed. */
+bool mdadm_aio_poll(mdadm_aio_t *aio);
+
+/* Waits for |aio| to complete and returns its result. */
+int mdadm_aio_wait(mdadm_aio_t *aio);
+
+/* Waits until every submitted request has completed. */
+void mdadm_aio_drain(void);
+
+#endif
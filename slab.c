@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+struct slab {
+  uint8_t *base;
+  void *map;      /* the mapping to unmap, or NULL for heap memory */
+  size_t map_size;
+  bool huge;
+};
+
+/* Maps |size| bytes, a multiple of the hugepage size, starting on a
+ * hugepage boundary: maps one hugepage more than needed and unmaps the
+ * misaligned head and the tail. Returns the start or MAP_FAILED. */
+static void *map_huge(size_t size) {
+  size_t span = size + SLAB_HUGEPAGE_SIZE;
+  uint8_t *p = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED)
+    return MAP_FAILED;
+
+  size_t head = -(uintptr_t)p & (SLAB_HUGEPAGE_SIZE - 1);
+  if (head > 0)
+    munmap(p, head);
+  if (span - head > size)
+    munmap(p + head + size, span - head - size);
+  return p + head;
+}
+
+slab_t *slab_create(size_t size) {
+  if (size == 0)
+    return NULL;
+
+  slab_t *s = calloc(1, sizeof(slab_t));
+  if (s == NULL)
+    return NULL;
+  s->map = MAP_FAILED;
+#ifdef MADV_HUGEPAGE
+  if (size >= SLAB_HUGEPAGE_SIZE / 2) {
+    s->map_size = (size + SLAB_HUGEPAGE_SIZE - 1) & ~(size_t)(SLAB_HUGEPAGE_SIZE - 1);
+    s->map = map_huge(s->map_size);
+    s->huge = s->map != MAP_FAILED && madvise(s->map, s->map_size, MADV_HUGEPAGE) == 0;
+  }
+#endif
+  if (s->map == MAP_FAILED) {
+    s->map_size = size;
+    s->map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+  if (s->map != MAP_FAILED) {
+    s->base = s->map;
+    return s;
+  }
+
+  /* Fresh anonymous pages are zero, heap memory has to be cleared. */
+  s->map = NULL;
+  size = (size + 63) & ~(size_t)63;
+  s->base = aligned_alloc(64, size);
+  if (s->base == NULL) {
+    free(s);
+    return NULL;
+  }
+  memset(s->base, 0, size);
+  return s;
+}
+
+void slab_destroy(slab_t *s) {
+  if (s == NULL)
+    return;
+  if (s->map != NULL)
+    munmap(s->map, s->map_size);
+  else
+    free(s->base);
+  free(s);
+}
+
+uint8_t *slab_base(const slab_t *s) { return s->base; }
+
+bool slab_huge(const slab_t *s) { return s->huge; }
@@ -0,0 +1,33 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_HUGEPAGE_SIZE (2 << 20)
+
+/* Arena for cache payloads. The arena is reserved as an anonymous mapping
+ * and never written when created, so the kernel only backs (and zeroes)
+ * the pages that slots actually get filled into, and a cache of any size
+ * opens in about the same time. An arena of at least half a hugepage is
+ * rounded up to whole 2 MB hugepages, aligned to one, and advised with
+ * MADV_HUGEPAGE, so the whole cache is covered by one or two TLB entries
+ * instead of up to 256. Where mmap is not available or fails, the arena
+ * falls back to zeroed heap memory. */
+typedef struct slab slab_t;
+
+/* Returns an arena of at least |size| zeroed bytes aligned to a cache line,
+ * or NULL. */
+slab_t *slab_create(size_t size);
+
+void slab_destroy(slab_t *s);
+
+/* Returns the first byte of the arena. */
+uint8_t *slab_base(const slab_t *s);
+
+/* Returns true if the arena was advised to use hugepages. Whether the
+ * kernel honours the advice depends on its transparent hugepage setting. */
+bool slab_huge(const slab_t *s);
+
+#endif
@@ -10,19 +10,40 @@
 #include <fcntl.h>
 #include <err.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "cache.h"
 #include "jbod.h"
 #include "mdadm.h"
 #include "util.h"
 #include "tester.h"
+#include "keysearch.h"
+#include "mdadm_aio.h"
+#include "slab.h"
 
-#define TESTER_ARGUMENTS "hw:s:"
+#define TESTER_ARGUMENTS "hw:s:p:br:t:a:q:e:j:gl"
 #define USAGE                                               \
   "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
+  "            [-p policy] [-b] [-r blocks] [-t threads]\n"  \
+  "            [-a ways] [-q depth] [-e scheduler]\n"        \
+  "            [-j stats-file] [-g] [-l]\n"                 \
   "\n"                                                      \
   "where:\n"                                                \
   "    -h - help mode (display this message)\n"             \
+  "    -p - eviction policy: lru, clock, 2q, arc, lfu\n"    \
+  "    -b - write-back cache (default: write-through)\n"    \
+  "    -r - max read-ahead window in blocks (default: 0)\n" \
+  "    -a - set-associative cache with this many ways\n"    \
+  "    -q - replay through the asynchronous API with up to\n" \
+  "         this many requests in flight\n"                   \
+  "    -e - order of queued requests with -q: fifo, clook\n"   \
+  "    -j - write the mdadm counters to this file as JSON\n"  \
+  "    -g - also report the hit rate at half and twice the\n"  \
+  "         cache size, from ghost entries\n"                  \
+  "    -l - TinyLFU admission filter in front of inserts\n"    \
+  "    -t - replay reads and writes with this many threads\n" \
+  "         over a cache with one shard per thread\n"         \
   "\n"                                                      \
 
 /* Test functions for the assignment 2. */
@@ -50,6 +71,24 @@ int test_cache_update();
 int test_cache_lru_insert();
 int test_cache_lru_lookup();
 
+/* Test functions for the extensions. */
+int test_cache_policies();
+int test_cache_write_back();
+int test_readv_writev();
+int test_cache_get_put();
+int test_threads();
+int test_cache_instances();
+int test_keysearch();
+int test_cache_set_associative();
+int test_aio();
+int test_stats();
+int test_cache_ghost();
+int test_cache_admission();
+int test_slab();
+int test_cache_resize();
+int test_cache_snapshot();
+int test_readahead();
+
 /* Utility functions. */
 char *stringify(const uint8_t *buf, int length) {
   char *p = (char *)malloc(length * 6);
@@ -61,12 +100,21 @@ char *stringify(const uint8_t *buf, int length) {
   return p;
 }
 
-int run_workload(char *workload, int cache_size);
+/* Where -j writes the counters at the end of a workload, or NULL. */
+static const char *stats_path = NULL;
+
+int run_workload(char *workload, int cache_size, const cache_options_t *options);
+int run_workload_threads(char *workload, int cache_size, cache_options_t *options,
+                         int num_threads);
+int run_workload_async(char *workload, int cache_size, const cache_options_t *options,
+                       int queue_depth, const mdadm_aio_options_t *aio_options);
 
 int main(int argc, char *argv[])
 {
-  int ch, cache_size = 0;
+  int ch, cache_size = 0, num_threads = 1, queue_depth = 0;
   char *workload = NULL;
+  cache_options_t options = { .policy = CACHE_POLICY_LRU };
+  mdadm_aio_options_t aio_options = { MDADM_SCHED_CLOOK, 64 };
 
   while ((ch = getopt(argc, argv, TESTER_ARGUMENTS)) != -1) {
     switch (ch) {
@@ -79,14 +127,71 @@ int main(int argc, char *argv[])
       case 'w':
         workload = optarg;
         break;
+      case 'p':
+        options.policy = cache_policy_from_name(optarg);
+        if ((int)options.policy == -1) {
+          fprintf(stderr, "Unknown eviction policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'b':
+        options.write_back = true;
+        break;
+      case 'r':
+        mdadm_set_readahead(atoi(optarg));
+        break;
+      case 'a':
+        options.ways = atoi(optarg);
+        break;
+      case 'g':
+        options.ghost = true;
+        break;
+      case 'l':
+        options.admission = true;
+        break;
+      case 'q':
+        queue_depth = atoi(optarg);
+        if (queue_depth < 1) {
+          fprintf(stderr, "Invalid queue depth (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'e':
+        if (strcmp(optarg, "fifo") == 0) {
+          aio_options.scheduler = MDADM_SCHED_FIFO;
+        } else if (strcmp(optarg, "clook") == 0) {
+          aio_options.scheduler = MDADM_SCHED_CLOOK;
+        } else {
+          fprintf(stderr, "Unknown scheduler (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'j':
+        stats_path = optarg;
+        break;
+      case 't':
+        num_threads = atoi(optarg);
+        if (num_threads < 1) {
+          fprintf(stderr, "Invalid number of threads (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
       default:
         fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
         return -1;
     }
   }
 
+  if (workload && queue_depth > 0) {
+    run_workload_async(workload, cache_size, &options, queue_depth, &aio_options);
+    return 0;
+  }
+  if (workload && num_threads > 1) {
+    run_workload_threads(workload, cache_size, &options, num_threads);
+    return 0;
+  }
   if (workload) {
-    run_workload(workload, cache_size);
+    run_workload(workload, cache_size, &options);
     return 0;
   }
 
@@ -114,7 +219,24 @@ int main(int argc, char *argv[])
   score += test_cache_lru_insert();
   score += test_cache_lru_lookup();
 
-  printf("Total score: %d/%d\n", score, 25);
+  score += test_cache_policies();
+  score += test_cache_write_back();
+  score += test_readv_writev();
+  score += test_cache_get_put();
+  score += test_threads();
+  score += test_cache_instances();
+  score += test_keysearch();
+  score += test_cache_set_associative();
+  score += test_aio();
+  score += test_stats();
+  score += test_cache_ghost();
+  score += test_cache_admission();
+  score += test_slab();
+  score += test_cache_resize();
+  score += test_cache_snapshot();
+  score += test_readahead();
+
+  printf("Total score: %d/%d\n", score, 41);
 
   return 0;
 }
@@ -1037,63 +1159,1418 @@ out:
   return 2;
 }
 
-int equals(const char *s1, const char *s2) {
-  return strncmp(s1, s2, strlen(s2)) == 0;
+/* Every eviction policy must keep exactly |num_entries| blocks once the cache
+ * is full and always return the data that was inserted for a block. */
+int test_cache_policies() {
+  printf("running %s: ", __func__);
+
+  uint8_t in[JBOD_BLOCK_SIZE];
+  uint8_t out[JBOD_BLOCK_SIZE];
+
+  for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+    cache_options_t options = { .policy = p };
+    bool success = false;
+
+    if (cache_create_ex(8, &options) != 1) {
+      printf("failed: creating a %s cache should succeed but it failed.\n", cache_policy_name(p));
+      return 0;
+    }
+
+    /* Insert 32 blocks, re-reading some of them along the way so that the
+     * policies have something other than insertion order to go by. */
+    for (int i = 0; i < 32; i++) {
+      memset(in, i, JBOD_BLOCK_SIZE);
+      if (cache_insert(i % 4, i, in) != 1) {
+        printf("failed: inserting into a %s cache should succeed but it failed.\n", cache_policy_name(p));
+        goto out;
+      }
+      cache_lookup((i / 2) % 4, i / 2, out);
+    }
+
+    int resident = 0;
+    for (int i = 0; i < 32; i++) {
+      if (cache_lookup(i % 4, i, out) == -1)
+        continue;
+      memset(in, i, JBOD_BLOCK_SIZE);
+      if (memcmp(in, out, JBOD_BLOCK_SIZE) != 0) {
+        printf("failed: a %s cache returned the wrong data for block %d.\n", cache_policy_name(p), i);
+        goto out;
+      }
+      ++resident;
+    }
+    if (resident != 8) {
+      printf("failed: a full %s cache of 8 entries holds %d blocks.\n", cache_policy_name(p), resident);
+      goto out;
+    }
+    success = true;
+
+  out:
+    cache_destroy();
+    if (!success)
+      return 0;
+  }
+
+  printf("passed\n");
+  return 1;
 }
 
-int run_workload(char *workload, int cache_size) {
-  char line[256], cmd[32];
-  uint8_t buf[MAX_IO_SIZE];
-  uint32_t addr, len, ch;
-  int rc;
+/* A write-back cache must serve the written data immediately but only put it
+ * on disk when flushed, or when cleaned ahead of its eviction. */
+static bool write_back_fails;
 
-  memset(buf, 0, MAX_IO_SIZE);
+static int flaky_write_back(int disk_num, int block_num, const uint8_t *buf) {
+  return write_back_fails ? -1 : 1;
+}
 
-  FILE *f = fopen(workload, "r");
-  if (!f)
-    err(1, "Cannot open workload file %s", workload);
+static int clean_calls, num_cleaned, cleaned[4];
 
-  if (cache_size) {
-    rc = cache_create(cache_size);
-    if (rc != 1)
-      errx(1, "Failed to create cache.");
+static int record_clean(int count, const int *blocks, const uint8_t *const *bufs) {
+  clean_calls++;
+  for (int i = 0; i < count && num_cleaned < 4; i++)
+    cleaned[num_cleaned++] = blocks[i];
+  return 1;
+}
+
+int test_cache_write_back() {
+  printf("running %s: ", __func__);
+
+  bool success = false;
+  cache_options_t options = { .policy = CACHE_POLICY_LRU, .write_back = true };
+  /* Large enough that the written block is nowhere near eviction, so mdadm
+   * does not clean it ahead. */
+  cache_create_ex(1024, &options);
+  mdadm_mount();
+
+  /* Set the contents of JBOD drives to a specific pattern. */
+  jbod_initialize_drives_contents();
+
+  uint8_t to_write[SIZE];
+  memset(to_write, 0xaa, SIZE);
+  if (mdadm_write(256, SIZE, to_write) != SIZE) {
+    printf("failed: write failed\n");
+    goto out;
   }
 
-  int line_num = 0;
-  while (fgets(line, 256, f)) {
-    ++line_num;
-    line[strlen(line)-1] = '\0';
-    if (equals(line, "MOUNT")) {
-      rc = mdadm_mount();
-    } else if (equals(line, "UNMOUNT")) {
-      rc = mdadm_unmount();
-    } else if (equals(line, "SIGNALL")) {
-      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
-        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j)
-          jbod_sign_block(i, j);
-    } else {
-      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
-        errx(1, "Failed to parse command: [%s\n], aborting.", line);
-      if (equals(cmd, "READ")) {
-        rc = mdadm_read(addr, len, buf);
-      } else if (equals(cmd, "WRITE")) {
-        memset(buf, ch, len);
-        rc = mdadm_write(addr, len, buf);
-      } else {
-        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
-      }
+  uint8_t out[JBOD_BLOCK_SIZE];
+  if (mdadm_read(256, SIZE, out) != SIZE || memcmp(out, to_write, SIZE) != 0) {
+    printf("failed: reading back a write absorbed by the cache returned stale data.\n");
+    goto out;
+  }
+
+  uint8_t expected[JBOD_BLOCK_SIZE];
+  memset(expected, 0xbb, JBOD_BLOCK_SIZE);
+  jbod_fill_block_test_write_within_block(out);
+  if (memcmp(out, expected, JBOD_BLOCK_SIZE) != 0) {
+    printf("failed: a write-back cache should not write to disk before a flush.\n");
+    goto out;
+  }
+
+  if (cache_flush() != 1) {
+    printf("failed: flushing a write-back cache should succeed but it failed.\n");
+    goto out;
+  }
+
+  memset(expected, 0xaa, SIZE);
+  jbod_fill_block_test_write_within_block(out);
+  if (memcmp(out, expected, JBOD_BLOCK_SIZE) != 0) {
+    char *out_s = stringify(out, JBOD_BLOCK_SIZE);
+    char *expected_s = stringify(expected, JBOD_BLOCK_SIZE);
+
+    printf("failed:\n  got:      %s\n  expected: %s\n", out_s, expected_s);
+
+    free(out_s);
+    free(expected_s);
+    goto out;
+  }
+
+  /* A victim whose write-back fails stays where it was in the eviction
+   * order, so it is still the one evicted once write-backs work again. */
+  for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+    cache_options_t policy = { .policy = p, .write_back = true };
+    cache_t *cache = cache_open(2, &policy);
+    cache_set_writeback_h(cache, flaky_write_back);
+    cache_write_h(cache, 2, 0, expected);
+    cache_write_h(cache, 2, 1, expected);
+    write_back_fails = true;
+    bool refused = cache_insert_h(cache, 2, 2, expected) == -1;
+    write_back_fails = false;
+    bool kept_order = cache_insert_h(cache, 2, 2, expected) == 1 &&
+                      !cache_contains_h(cache, 2, 0) && cache_contains_h(cache, 2, 1);
+    cache_close(cache);
+    if (!refused || !kept_order) {
+      printf("failed: a failed write-back moved the %s victim.\n", cache_policy_name(p));
+      goto out;
     }
+  }
 
-    if (rc == -1)
-      errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
+  /* Cleaning ahead writes back the dirty blocks of one disk among the next
+   * victims, in block order and in one call, and leaves them clean. */
+  cache_t *cache = cache_open(4, &options);
+  cache_write_h(cache, 3, 9, expected);
+  cache_write_h(cache, 4, 0, expected);
+  cache_write_h(cache, 3, 5, expected);
+  cache_write_h(cache, 3, 1, expected);
+  int first = cache_clean_ahead_h(cache, 3, 3, record_clean);
+  int again = cache_clean_ahead_h(cache, 3, 3, record_clean);
+  cache_close(cache);
+  if (first != 2 || again != 0 || clean_calls != 1 || num_cleaned != 2 ||
+      cleaned[0] != 3 * JBOD_NUM_BLOCKS_PER_DISK + 5 ||
+      cleaned[1] != 3 * JBOD_NUM_BLOCKS_PER_DISK + 9) {
+    printf("failed: cleaning ahead wrote back the wrong blocks.\n");
+    goto out;
   }
-  fclose(f);
+  success = true;
 
-  if (cache_size)
-    cache_destroy();
+out:
+  mdadm_unmount();
+  cache_destroy();
+  if (!success)
+    return 0;
 
-  jbod_print_cost();
-  cache_print_hit_rate();
+  printf("passed\n");
+  return 1;
+}
 
-  return 0;
+/* Vectored I/O must give the same result as issuing the ranges one by one,
+ * including when ranges overlap or share blocks. */
+int test_readv_writev() {
+  printf("running %s: ", __func__);
+
+  bool success = false;
+  cache_create(16);
+  mdadm_mount();
+
+  uint8_t a[300], b[40], c[100];
+  memset(a, 0x11, sizeof(a));
+  memset(b, 0x22, sizeof(b));
+  memset(c, 0x33, sizeof(c));
+
+  /* Out of order, across a disk boundary, and |b| overlapping |a|. */
+  mdadm_iovec_t wv[] = {
+    { 65500, sizeof(c), c },
+    { 1000, sizeof(a), a },
+    { 1200, sizeof(b), b },
+  };
+  if (mdadm_writev(wv, 3) != sizeof(a) + sizeof(b) + sizeof(c)) {
+    printf("failed: writev failed\n");
+    goto out;
+  }
+
+  uint8_t expected[300], out[300];
+  memcpy(expected, a, sizeof(a));
+  memcpy(expected + 200, b, sizeof(b));
+  if (mdadm_read(1000, sizeof(out), out) != sizeof(out) ||
+      memcmp(out, expected, sizeof(out)) != 0) {
+    printf("failed: overlapping ranges were not applied in order.\n");
+    goto out;
+  }
+
+  uint8_t r1[100], r2[50], r3[20];
+  mdadm_iovec_t rv[] = {
+    { 65500, sizeof(r1), r1 },
+    { 1150, sizeof(r2), r2 },
+    { 1020, sizeof(r3), r3 },
+  };
+  if (mdadm_readv(rv, 3) != sizeof(r1) + sizeof(r2) + sizeof(r3)) {
+    printf("failed: readv failed\n");
+    goto out;
+  }
+  if (memcmp(r1, c, sizeof(r1)) != 0 ||
+      memcmp(r2, expected + 150, sizeof(r2)) != 0 ||
+      memcmp(r3, expected + 20, sizeof(r3)) != 0) {
+    printf("failed: readv returned different data than the ranges hold.\n");
+    goto out;
+  }
+
+  mdadm_iovec_t bad[] = {
+    { 0, 16, r1 },
+    { 1048570, 16, r1 },
+  };
+  if (mdadm_readv(bad, 2) != -1) {
+    printf("failed: readv should fail if one of the ranges is invalid but it did not.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  mdadm_unmount();
+  cache_destroy();
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+/* A block pinned with cache_get must survive evictions until cache_put, and
+ * a cache whose entries are all pinned must refuse inserts. */
+int test_cache_get_put() {
+  printf("running %s: ", __func__);
+
+  uint8_t in1[JBOD_BLOCK_SIZE] = { [0 ... JBOD_BLOCK_SIZE-1] = 0xaa };
+  uint8_t in2[JBOD_BLOCK_SIZE] = { [0 ... JBOD_BLOCK_SIZE-1] = 0xbb };
+  uint8_t in3[JBOD_BLOCK_SIZE] = { [0 ... JBOD_BLOCK_SIZE-1] = 0xcc };
+
+  bool success = false;
+  cache_create(2);
+
+  cache_insert(8, 9, in1);
+  cache_insert(3, 5, in2);
+
+  const uint8_t *p1 = cache_get(8, 9);
+  if (p1 == NULL || memcmp(p1, in1, JBOD_BLOCK_SIZE) != 0) {
+    printf("failed: cache_get of a cached block should return its data.\n");
+    goto out;
+  }
+  if (cache_get(13, 13) != NULL) {
+    printf("failed: cache_get of a non-existent entry should fail but succeeded.\n");
+    goto out;
+  }
+
+  /* 3, 5 is now the least recently used entry, so make 8, 9 the LRU one. */
+  uint8_t out[JBOD_BLOCK_SIZE];
+  cache_lookup(3, 5, out);
+  if (cache_insert(1, 7, in3) != 1 || cache_lookup(3, 5, out) != -1) {
+    printf("failed: the insert should have evicted the unpinned entry 3, 5.\n");
+    goto out;
+  }
+  if (memcmp(p1, in1, JBOD_BLOCK_SIZE) != 0) {
+    printf("failed: a pinned block changed under its reference.\n");
+    goto out;
+  }
+
+  const uint8_t *p3 = cache_get(1, 7);
+  if (cache_insert(3, 5, in2) != -1) {
+    printf("failed: inserting into a cache whose entries are all pinned should fail.\n");
+    goto out;
+  }
+
+  cache_put(8, 9);
+  if (p3 == NULL || cache_insert(3, 5, in2) != 1 || cache_lookup(8, 9, out) != -1) {
+    printf("failed: after cache_put the released entry should be evictable again.\n");
+    goto out;
+  }
+  cache_put(1, 7);
+
+  /* An insert refused because everything is pinned leaves ARC as it was.
+   * Block 1 is a ghost in B1, so a miss on it would grow T1's target size,
+   * and once blocks 3 and 4 come in, block 2 would be evicted from T2
+   * instead of block 3 from T1. */
+  cache_options_t arc = { .policy = CACHE_POLICY_ARC };
+  cache_t *cache = cache_open(2, &arc);
+  cache_insert_h(cache, 0, 0, in1);
+  cache_insert_h(cache, 0, 1, in1);
+  cache_lookup_h(cache, 0, 0, out);
+  cache_insert_h(cache, 0, 2, in1);
+  cache_get_h(cache, 0, 0);
+  cache_get_h(cache, 0, 2);
+  bool refused = cache_insert_h(cache, 0, 1, in1) == -1;
+  cache_put_h(cache, 0, 0);
+  cache_put_h(cache, 0, 2);
+  bool kept = cache_insert_h(cache, 0, 3, in1) == 1;
+  kept = kept && cache_insert_h(cache, 0, 4, in1) == 1 &&
+         cache_contains_h(cache, 0, 2) && !cache_contains_h(cache, 0, 3);
+  cache_close(cache);
+  if (!refused || !kept) {
+    printf("failed: an insert refused with every entry pinned changed ARC.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  cache_destroy();
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+int test_cache_instances() {
+  printf("running %s: ", __func__);
+
+  cache_options_t lfu = { .policy = CACHE_POLICY_LFU };
+  uint8_t in[JBOD_BLOCK_SIZE], out[JBOD_BLOCK_SIZE];
+  cache_t *small = cache_open(2, NULL);
+  cache_t *large = cache_open(8, &lfu);
+  bool success = false;
+
+  if (small == NULL || large == NULL || cache_create(4) != 1) {
+    printf("failed: opening several caches at once failed.\n");
+    goto out;
+  }
+  if (cache_open(1, NULL) != NULL) {
+    printf("failed: cache_open should fail for an invalid size.\n");
+    goto out;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    memset(in, i, JBOD_BLOCK_SIZE);
+    cache_insert_h(small, 0, i, in);
+    cache_insert_h(large, 0, i, in);
+  }
+  if (cache_lookup(0, 3, out) != -1) {
+    printf("failed: blocks inserted into a handle leaked into the default cache.\n");
+    goto out;
+  }
+  if (cache_lookup_h(small, 0, 1, out) != -1 || cache_lookup_h(small, 0, 3, out) != 1) {
+    printf("failed: the small cache should only keep the two newest blocks.\n");
+    goto out;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (cache_lookup_h(large, 0, i, out) != 1 || out[0] != i) {
+      printf("failed: the large cache should keep every block.\n");
+      goto out;
+    }
+  }
+  if (cache_capacity_h(small) != 2 || cache_capacity_h(large) != 8 ||
+      cache_capacity() != 4) {
+    printf("failed: caches report the wrong capacity.\n");
+    goto out;
+  }
+
+  cache_stats_t stats;
+  cache_get_stats_h(large, &stats);
+  if (stats.queries != 4 || stats.hits != 4) {
+    printf("failed: per-cache counters are wrong.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  cache_close(small);
+  cache_close(large);
+  cache_destroy();
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+int test_keysearch() {
+  printf("running %s: ", __func__);
+
+  uint16_t keys[70];
+  keysearch_impl_t best = keysearch_selected();
+  bool success = false;
+
+  for (int i = 0; i < 70; i++)
+    keys[i] = 1000 + i % 35;  /* every key appears twice */
+
+  /* Every supported implementation must agree with a plain loop for every
+   * length, including the tails shorter than a vector. */
+  for (int impl = 0; impl < KEYSEARCH_NUM_IMPLS; impl++) {
+    if (keysearch_select(impl) != 1)
+      continue;
+    for (int n = 0; n <= 70; n++) {
+      for (int key = 990; key < 1040; key++) {
+        int expected = -1;
+        for (int i = 0; i < n && expected == -1; i++)
+          if (keys[i] == key)
+            expected = i;
+        if (keysearch_find(keys, n, key) != expected) {
+          printf("failed: %s search for %d in %d keys returned %d, expected %d.\n",
+                 keysearch_impl_name(impl), key, n, keysearch_find(keys, n, key),
+                 expected);
+          goto out;
+        }
+      }
+    }
+  }
+  if (keysearch_select(KEYSEARCH_NUM_IMPLS) != -1) {
+    printf("failed: selecting an invalid implementation should fail.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  keysearch_select(best);
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+int test_cache_set_associative() {
+  printf("running %s: ", __func__);
+
+  cache_options_t one_set = { .ways = 4 }, two_way = { .ways = 2 };
+  cache_options_t arc = { .policy = CACHE_POLICY_ARC, .ways = 2 };
+  cache_options_t too_wide = { .ways = 5 };
+  uint8_t in[JBOD_BLOCK_SIZE], out[JBOD_BLOCK_SIZE];
+  cache_t *c = NULL;
+  bool success = false;
+
+  if ((c = cache_open(4, &arc)) != NULL || (c = cache_open(4, &too_wide)) != NULL) {
+    printf("failed: invalid set-associative options should be rejected.\n");
+    goto out;
+  }
+
+  /* With a single set, the cache is plain LRU. */
+  c = cache_open(4, &one_set);
+  for (int i = 0; i < 4; i++) {
+    memset(in, i, JBOD_BLOCK_SIZE);
+    cache_insert_h(c, 1, i, in);
+  }
+  cache_lookup_h(c, 1, 0, out);
+  memset(in, 4, JBOD_BLOCK_SIZE);
+  cache_insert_h(c, 1, 4, in);
+  if (cache_contains_h(c, 1, 1) || !cache_contains_h(c, 1, 0) ||
+      cache_lookup_h(c, 1, 4, out) != 1 || out[0] != 4) {
+    printf("failed: a single set should evict its least recently used block.\n");
+    goto out;
+  }
+  cache_close(c);
+
+  /* With several sets, the newest block always stays, no set holds more
+   * than its ways and every cached block keeps its own data. */
+  c = cache_open(8, &two_way);
+  for (int b = 0; b < 256; b++) {
+    memset(in, b, JBOD_BLOCK_SIZE);
+    if (cache_insert_h(c, 2, b, in) != 1 || !cache_contains_h(c, 2, b)) {
+      printf("failed: inserting into a set-associative cache failed.\n");
+      goto out;
+    }
+  }
+  int cached = 0;
+  for (int b = 0; b < 256; b++) {
+    if (cache_lookup_h(c, 2, b, out) != 1)
+      continue;
+    cached++;
+    if (out[0] != b) {
+      printf("failed: a set-associative lookup returned the wrong block.\n");
+      goto out;
+    }
+  }
+  if (cached == 0 || cached > 8) {
+    printf("failed: a set-associative cache holds %d blocks.\n", cached);
+    goto out;
+  }
+  success = true;
+
+out:
+  cache_close(c);
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+#define THREADS_TEST_THREADS 4
+#define THREADS_TEST_LEN 100
+#define THREADS_TEST_ROUNDS 200
+#define THREADS_TEST_REWRITES 20000
+
+static void *threads_test_worker(void *arg) {
+  int t = (int)(intptr_t)arg;
+  uint8_t buf[THREADS_TEST_LEN];
+
+  memset(buf, t + 1, THREADS_TEST_LEN);
+  for (int i = 0; i < THREADS_TEST_ROUNDS; i++) {
+    /* Neighbouring threads write different halves of the same blocks. */
+    uint32_t addr = (i * THREADS_TEST_THREADS + t) * THREADS_TEST_LEN;
+    if (mdadm_write(addr, THREADS_TEST_LEN, buf) != THREADS_TEST_LEN)
+      return (void *)1;
+  }
+  return NULL;
+}
+
+/* Rewrites block 0 whole, each time with a single repeated byte. */
+static void *threads_test_rewriter(void *arg) {
+  uint8_t buf[JBOD_BLOCK_SIZE];
+
+  for (int i = 0; i < THREADS_TEST_REWRITES; i++) {
+    memset(buf, i, JBOD_BLOCK_SIZE);
+    if (mdadm_write(0, JBOD_BLOCK_SIZE, buf) != JBOD_BLOCK_SIZE)
+      return (void *)1;
+  }
+  return NULL;
+}
+
+int test_threads() {
+  printf("running %s: ", __func__);
+
+  cache_options_t options = { .write_back = true, .shards = 4 };
+  pthread_t threads[THREADS_TEST_THREADS];
+  uint8_t out[THREADS_TEST_LEN];
+  bool success = false;
+
+  if (cache_create_ex(64, &options) != 1) {
+    printf("failed: creating a sharded cache failed.\n");
+    return 0;
+  }
+  mdadm_mount();
+
+  intptr_t failed = 0;
+  for (intptr_t t = 0; t < THREADS_TEST_THREADS; t++)
+    pthread_create(&threads[t], NULL, threads_test_worker, (void *)t);
+  for (int t = 0; t < THREADS_TEST_THREADS; t++) {
+    void *rc;
+    pthread_join(threads[t], &rc);
+    failed |= (intptr_t)rc;
+  }
+  if (failed) {
+    printf("failed: a concurrent write failed.\n");
+    goto out;
+  }
+
+  for (int i = 0; i < THREADS_TEST_ROUNDS * THREADS_TEST_THREADS; i++) {
+    if (mdadm_read(i * THREADS_TEST_LEN, THREADS_TEST_LEN, out) != THREADS_TEST_LEN) {
+      printf("failed: read after concurrent writes failed.\n");
+      goto out;
+    }
+    for (int j = 0; j < THREADS_TEST_LEN; j++) {
+      if (out[j] != i % THREADS_TEST_THREADS + 1) {
+        printf("failed: a concurrent write to a shared block was lost.\n");
+        goto out;
+      }
+    }
+  }
+
+  /* A read hitting a block that is being rewritten sees one write or the
+   * other, never a mix of both. */
+  pthread_t rewriter;
+  uint8_t block[JBOD_BLOCK_SIZE];
+  bool torn = false;
+  memset(block, 0, JBOD_BLOCK_SIZE);
+  mdadm_write(0, JBOD_BLOCK_SIZE, block);
+  pthread_create(&rewriter, NULL, threads_test_rewriter, NULL);
+  for (int i = 0; i < THREADS_TEST_REWRITES && !torn; i++) {
+    mdadm_read(0, JBOD_BLOCK_SIZE, block);
+    for (int j = 1; j < JBOD_BLOCK_SIZE; j++)
+      torn |= block[j] != block[0];
+  }
+  void *rc;
+  pthread_join(rewriter, &rc);
+  if (rc != NULL || torn) {
+    printf("failed: a read overlapping a write returned a torn block.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  mdadm_unmount();
+  cache_destroy();
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+static void aio_test_done(mdadm_aio_t *aio) {
+  (*(int *)aio->arg)++;
+}
+
+int test_aio() {
+  printf("running %s: ", __func__);
+
+  mdadm_aio_t aios[4];
+  uint8_t in[2][300], out[2][300];
+  int calls = 0;
+  bool success = false;
+
+  for (int i = 0; i < 300; i++) {
+    in[0][i] = i;
+    in[1][i] = 255 - i;
+  }
+
+  mdadm_mount();
+  if (mdadm_aio_start(2) != 1) {
+    printf("failed: starting the worker failed.\n");
+    mdadm_unmount();
+    return 0;
+  }
+
+  /* Overlapping writes complete in submission order, and reads queued
+   * behind them see their data. */
+  for (int i = 0; i < 4; i++)
+    aios[i] = (mdadm_aio_t){ .addr = 1000 + i % 2 * 100, .len = 300,
+                             .buf = i < 2 ? in[i] : out[i - 2],
+                             .done = aio_test_done, .arg = &calls };
+  if (mdadm_write_async(&aios[0]) != 1 || mdadm_write_async(&aios[1]) != 1 ||
+      mdadm_read_async(&aios[2]) != 1 || mdadm_read_async(&aios[3]) != 1) {
+    printf("failed: submitting a request failed.\n");
+    goto out;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (mdadm_aio_wait(&aios[i]) != 300 || !mdadm_aio_poll(&aios[i])) {
+      printf("failed: request %d did not complete.\n", i);
+      goto out;
+    }
+  }
+  if (calls != 4) {
+    printf("failed: completion callback ran %d times.\n", calls);
+    goto out;
+  }
+  if (memcmp(out[0], in[0], 100) != 0 || memcmp(out[0] + 100, in[1], 200) != 0 ||
+      memcmp(out[1], in[1], 300) != 0) {
+    printf("failed: read did not return the data written before it.\n");
+    goto out;
+  }
+
+  aios[0] = (mdadm_aio_t){ .addr = JBOD_DISK_SIZE * JBOD_NUM_DISKS, .len = 1,
+                           .buf = out[0] };
+  if (mdadm_read_async(&aios[0]) != 1 || mdadm_aio_wait(&aios[0]) != -1) {
+    printf("failed: an out-of-bounds read did not fail.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  mdadm_aio_stop();
+  mdadm_unmount();
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+int test_stats() {
+  printf("running %s: ", __func__);
+
+  mdadm_stats_t stats;
+  uint8_t buf[JBOD_BLOCK_SIZE * 2];
+  char json[4096];
+  bool success = false;
+
+  memset(buf, 7, sizeof(buf));
+  if (cache_create(16) != 1) {
+    printf("failed: creating the cache failed.\n");
+    return 0;
+  }
+  mdadm_mount();
+  mdadm_stats_reset();
+
+  /* Two blocks on disk 1, written whole and read back twice: the first read
+   * hits the blocks the write cached. */
+  if (mdadm_write(JBOD_DISK_SIZE, sizeof(buf), buf) != sizeof(buf) ||
+      mdadm_read(JBOD_DISK_SIZE, sizeof(buf), buf) != sizeof(buf) ||
+      mdadm_read(JBOD_DISK_SIZE + sizeof(buf), 1, buf) != 1) {
+    printf("failed: I/O failed.\n");
+    goto out;
+  }
+  mdadm_stats(&stats);
+  if (stats.commands[JBOD_WRITE_BLOCK] != 2 || stats.commands[JBOD_READ_BLOCK] != 1 ||
+      stats.commands[JBOD_SEEK_TO_DISK] != 1 ||
+      stats.cost[JBOD_WRITE_BLOCK] != 400 || stats.cost[JBOD_READ_BLOCK] != 100) {
+    printf("failed: wrong command counts or cost.\n");
+    goto out;
+  }
+  uint64_t total = 0;
+  for (int i = 0; i < JBOD_NUM_CMDS; i++)
+    total += stats.cost[i];
+  if (total != stats.total_cost) {
+    printf("failed: total cost is not the sum of the command costs.\n");
+    goto out;
+  }
+  uint64_t bucketed = 0;
+  for (int i = 0; i < MDADM_LATENCY_BUCKETS; i++)
+    bucketed += stats.read.buckets[i];
+  if (stats.read.count != 2 || stats.write.count != 1 || bucketed != 2) {
+    printf("failed: wrong latency counts.\n");
+    goto out;
+  }
+  if (stats.cache.queries != 3 || stats.cache.hits != 2 || stats.cache.misses != 1 ||
+      stats.cache.inserts != 3) {
+    printf("failed: wrong cache counters.\n");
+    goto out;
+  }
+
+  FILE *f = fmemopen(json, sizeof(json), "w");
+  int rc = mdadm_stats_json(f);
+  fclose(f);
+  if (rc != 1 || json[0] != '{' ||
+      strstr(json, "\"write_block\": {\"count\": 2, \"cost\": 400}") == NULL) {
+    printf("failed: the JSON dump is wrong.\n");
+    goto out;
+  }
+  success = true;
+
+out:
+  mdadm_unmount();
+  cache_destroy();
+  if (!success)
+    return 0;
+
+  printf("passed\n");
+  return 1;
+}
+
+int test_cache_ghost() {
+  printf("running %s: ", __func__);
+
+  cache_options_t options = { .ghost = true };
+  cache_t *cache = cache_open(4, &options);
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+  cache_stats_t stats;
+
+  if (cache == NULL) {
+    printf("failed: creating a cache with ghost entries failed.\n");
+    return 0;
+  }
+  for (int i = 0; i < 6; i++)
+    cache_insert_h(cache, 0, i, buf);
+
+  /* Blocks 5 and 4 are the two most recent, so a cache of 2 would hit them
+   * too; block 0 has been evicted from this cache but not from one of 8. */
+  cache_lookup_h(cache, 0, 5, buf);
+  cache_lookup_h(cache, 0, 4, buf);
+  cache_lookup_h(cache, 0, 0, buf);
+  cache_get_stats_h(cache, &stats);
+  cache_close(cache);
+  if (stats.queries != 3 || stats.hits != 2 || stats.half_size_hits != 2 ||
+      stats.double_size_hits != 3) {
+    printf("failed: wrong ghost hit counts (half %llu, double %llu).\n",
+           (unsigned long long)stats.half_size_hits,
+           (unsigned long long)stats.double_size_hits);
+    return 0;
+  }
+
+  printf("passed\n");
+  return 1;
+}
+
+/* Reads the file at |path| into |buf|, which holds |size| bytes, and returns
+ * how many bytes it has, or -1. */
+static long read_file(const char *path, uint8_t *buf, size_t size) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    return -1;
+  long n = fread(buf, 1, size, f);
+  fclose(f);
+  return n;
+}
+
+int test_cache_admission() {
+  printf("running %s: ", __func__);
+
+  static uint8_t saved[2][16384];
+  char path[] = "/tmp/tester-admission-XXXXXX";
+  int fd = mkstemp(path);
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+  cache_stats_t stats;
+
+  if (fd == -1) {
+    printf("failed: cannot create a temporary file.\n");
+    return 0;
+  }
+  close(fd);
+  for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+    cache_options_t options = { .policy = p, .admission = true };
+    const char *name = cache_policy_name(p);
+    cache_t *caches[2] = { cache_open(4, &options), cache_open(4, &options) };
+    cache_t *cache = caches[0];
+    long size[2] = { -1, -1 };
+
+    if (caches[0] == NULL || caches[1] == NULL) {
+      printf("failed: creating a %s cache with an admission filter failed.\n", name);
+      cache_close(caches[0]);
+      cache_close(caches[1]);
+      remove(path);
+      return 0;
+    }
+    for (int k = 0; k < 2; k++) {
+      for (int i = 0; i < 4; i++) {
+        cache_insert_h(caches[k], 0, i, buf);
+        for (int j = 0; j < 3; j++)
+          cache_lookup_h(caches[k], 0, i, buf);
+      }
+    }
+
+    /* A scan reads each block once, so none of it displaces the hot blocks,
+     * and each refused victim goes back exactly as it was: the policy then
+     * orders the blocks like the one of a cache that never saw the scan,
+     * as snapshots, which list the blocks in eviction order, show. */
+    for (int i = 10; i < 28; i++)
+      cache_insert_h(cache, 1, i, buf);
+    bool kept = true;
+    for (int i = 0; i < 4; i++)
+      kept = kept && cache_contains_h(cache, 0, i);
+    for (int k = 0; k < 2; k++) {
+      cache_lookup_h(caches[k], 0, 0, buf);
+      if (cache_save_h(caches[k], path) == 1)
+        size[k] = read_file(path, saved[k], sizeof(saved[k]));
+    }
+    kept = kept && size[0] > 0 && size[0] == size[1] &&
+           memcmp(saved[0], saved[1], size[0]) == 0;
+
+    /* A block refused a moment ago is let in when it comes right back. */
+    bool readmitted = cache_insert_h(cache, 1, 27, buf) == 1;
+    cache_get_stats_h(cache, &stats);
+    cache_close(caches[0]);
+    cache_close(caches[1]);
+    if (!kept) {
+      printf("failed: a refused scan changed the hot blocks of a %s cache.\n", name);
+      remove(path);
+      return 0;
+    }
+    if (!readmitted || stats.rejections != 18) {
+      printf("failed: wrong %s admissions (%llu rejections).\n", name,
+             (unsigned long long)stats.rejections);
+      remove(path);
+      return 0;
+    }
+  }
+  remove(path);
+
+  printf("passed\n");
+  return 1;
+}
+
+int test_slab() {
+  printf("running %s: ", __func__);
+
+  /* One arena below the hugepage threshold and one rounded up past it. */
+  size_t sizes[] = { 1000, 3 * SLAB_HUGEPAGE_SIZE / 2 };
+  for (int i = 0; i < 2; i++) {
+    slab_t *s = slab_create(sizes[i]);
+    if (s == NULL) {
+      printf("failed: creating a %zu-byte arena failed.\n", sizes[i]);
+      return 0;
+    }
+    uint8_t *p = slab_base(s);
+    bool ok = (uintptr_t)p % 64 == 0 && p[0] == 0 && p[sizes[i] - 1] == 0;
+    p[0] = p[sizes[i] - 1] = 0xab;
+    ok = ok && p[0] == 0xab && p[sizes[i] - 1] == 0xab;
+    slab_destroy(s);
+    if (!ok) {
+      printf("failed: the %zu-byte arena is misaligned or not zeroed.\n", sizes[i]);
+      return 0;
+    }
+  }
+
+  printf("passed\n");
+  return 1;
+}
+
+static int resize_write_backs;
+
+static int count_write_back(int disk_num, int block_num, const uint8_t *buf) {
+  resize_write_backs++;
+  return 1;
+}
+
+int test_cache_resize() {
+  printf("running %s: ", __func__);
+
+  cache_options_t options = { .write_back = true };
+  cache_t *cache = cache_open(8, &options);
+  uint8_t buf[JBOD_BLOCK_SIZE] = { 0 };
+  bool ok = true;
+
+  cache_set_writeback_h(cache, count_write_back);
+  resize_write_backs = 0;
+  for (int i = 0; i < 8; i++)
+    cache_insert_h(cache, 0, i, buf);
+  cache_write_h(cache, 0, 5, buf);
+  for (int i = 0; i < 4; i++)
+    cache_lookup_h(cache, 0, i, buf);
+
+  /* Shrinking keeps the four most recent blocks, in order, and writes back
+   * the dirty block it drops. */
+  ok = cache_resize_h(cache, 4) == 1 && cache_capacity_h(cache) == 4 &&
+       resize_write_backs == 1;
+  for (int i = 0; i < 8; i++)
+    ok = ok && cache_contains_h(cache, 0, i) == (i < 4);
+  cache_insert_h(cache, 1, 0, buf);
+  ok = ok && !cache_contains_h(cache, 0, 0) && cache_contains_h(cache, 0, 1);
+  if (!ok) {
+    printf("failed: shrinking lost the recency order or a dirty block.\n");
+    cache_close(cache);
+    return 0;
+  }
+
+  /* Growing keeps everything and makes room without evicting. */
+  ok = cache_resize_h(cache, 16) == 1;
+  for (int i = 1; i < 13; i++)
+    cache_insert_h(cache, 2, i, buf);
+  for (int i = 1; i < 4; i++)
+    ok = ok && cache_contains_h(cache, 0, i);
+  ok = ok && cache_contains_h(cache, 1, 0);
+
+  /* A pinned block cannot move, and the size limits still hold. */
+  ok = ok && cache_get_h(cache, 0, 1) != NULL && cache_resize_h(cache, 8) == -1;
+  cache_put_h(cache, 0, 1);
+  ok = ok && cache_resize_h(cache, 1) == -1 && cache_capacity_h(cache) == 16;
+  cache_close(cache);
+  if (!ok) {
+    printf("failed: growing lost blocks or a resize that should fail did not.\n");
+    return 0;
+  }
+
+  /* Every policy keeps its blocks across a resize. */
+  for (int p = 0; p < CACHE_NUM_POLICIES; p++) {
+    cache_options_t policy = { .policy = p };
+    cache = cache_open(8, &policy);
+    for (int i = 0; i < 8; i++)
+      cache_insert_h(cache, 3, i, buf);
+    ok = cache_resize_h(cache, 12) == 1;
+    for (int i = 0; i < 8; i++)
+      ok = ok && cache_contains_h(cache, 3, i);
+    int kept = 0;
+    ok = ok && cache_resize_h(cache, 3) == 1;
+    for (int i = 0; i < 8; i++)
+      kept += cache_contains_h(cache, 3, i);
+    cache_close(cache);
+    if (!ok || kept != 3) {
+      printf("failed: resizing a %s cache lost blocks.\n", cache_policy_name(p));
+      return 0;
+    }
+  }
+
+  printf("passed\n");
+  return 1;
+}
+
+/* Returns the result of loading the snapshot at |path| into a fresh cache
+ * of |size| entries, which is left open. */
+static int reload_snapshot(const char *path, int size) {
+  cache_destroy();
+  cache_create(size);
+  return cache_load(path);
+}
+
+int test_cache_snapshot() {
+  printf("running %s: ", __func__);
+
+  char path[] = "/tmp/tester-snapshot-XXXXXX";
+  int fd = mkstemp(path);
+  uint8_t buf[JBOD_BLOCK_SIZE], out[JBOD_BLOCK_SIZE];
+  const char *failure = NULL;
+
+  if (fd == -1) {
+    printf("failed: cannot create a temporary file.\n");
+    return 0;
+  }
+  close(fd);
+  cache_create(8);
+  mdadm_mount();
+  for (int i = 0; i < 6; i++) {
+    memset(buf, i + 1, JBOD_BLOCK_SIZE);
+    mdadm_write(i * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, buf);
+  }
+  for (int i = 0; i < 4; i++)
+    mdadm_read(i * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, out);
+  mdadm_unmount();
+
+  /* A restart brings back every block with its data, and in LRU order:
+   * blocks 4 and 5 were used least recently, so they go first. */
+  if (cache_save(path) != 1 || reload_snapshot(path, 8) != 6) {
+    failure = "saving and loading a snapshot did not restore every block";
+    goto out;
+  }
+  mdadm_mount();
+  memset(buf, 3, JBOD_BLOCK_SIZE);
+  if (mdadm_read(2 * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, out) != JBOD_BLOCK_SIZE ||
+      memcmp(out, buf, JBOD_BLOCK_SIZE) != 0) {
+    failure = "a block loaded from a snapshot has the wrong data";
+    goto out;
+  }
+  for (int i = 0; i < 4; i++)
+    cache_insert(1, i, buf);
+  if (cache_contains(0, 4) || cache_contains(0, 5) || !cache_contains(0, 0)) {
+    failure = "a snapshot did not keep the recency order";
+    goto out;
+  }
+
+  /* A block written after the save is stale in the snapshot. */
+  memset(buf, 0xee, JBOD_BLOCK_SIZE);
+  mdadm_write(JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE, buf);
+  if (reload_snapshot(path, 8) != 5 || cache_contains(0, 1)) {
+    failure = "loading a snapshot kept a block written since";
+    goto out;
+  }
+
+  /* A corrupt block is dropped, a truncated file is refused. */
+  FILE *f = fopen(path, "r+b");
+  fseek(f, -1, SEEK_END);
+  fputc(0xff, f);
+  fclose(f);
+  if (reload_snapshot(path, 8) != 4 || truncate(path, 100) != 0 ||
+      reload_snapshot(path, 8) != -1) {
+    failure = "loading a damaged snapshot did not drop the damage";
+    goto out;
+  }
+
+out:
+  mdadm_unmount();
+  cache_destroy();
+  remove(path);
+  if (failure != NULL) {
+    printf("failed: %s.\n", failure);
+    return 0;
+  }
+
+  printf("passed\n");
+  return 1;
+}
+
+int equals(const char *s1, const char *s2) {
+  return strncmp(s1, s2, strlen(s2)) == 0;
+}
+
+/* Prints the hit rates the ghost entries estimate, if enabled. */
+static void print_ghost_hit_rates(const cache_options_t *options) {
+  cache_stats_t stats;
+
+  if (!options->ghost)
+    return;
+  cache_get_stats(&stats);
+  fprintf(stderr, "Hit rate at half size: %5.1f%%, at double size: %5.1f%%\n",
+          100 * (float) stats.half_size_hits / stats.queries,
+          100 * (float) stats.double_size_hits / stats.queries);
+}
+
+/* Prints the seeks issued so far, next to the cost, and writes the counters
+ * to |stats_path| if set. */
+static void print_seeks(void) {
+  mdadm_seek_stats_t seeks;
+  mdadm_seek_stats(&seeks);
+  fprintf(stderr, "Seeks: %llu (disk %llu, block %llu)\n",
+          (unsigned long long)(seeks.disk + seeks.block),
+          (unsigned long long)seeks.disk, (unsigned long long)seeks.block);
+
+  if (stats_path != NULL) {
+    FILE *f = fopen(stats_path, "w");
+    if (f == NULL || mdadm_stats_json(f) != 1)
+      warn("Cannot write the counters to %s", stats_path);
+    if (f != NULL)
+      fclose(f);
+  }
+}
+
+int run_workload(char *workload, int cache_size, const cache_options_t *options) {
+  char line[256], cmd[32];
+  uint8_t buf[MAX_IO_SIZE];
+  uint32_t addr, len, ch;
+  int rc;
+
+  memset(buf, 0, MAX_IO_SIZE);
+
+  FILE *f = fopen(workload, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", workload);
+
+  if (cache_size) {
+    rc = cache_create_ex(cache_size, options);
+    if (rc != 1)
+      errx(1, "Failed to create cache.");
+  }
+
+  int line_num = 0;
+  while (fgets(line, 256, f)) {
+    ++line_num;
+    line[strlen(line)-1] = '\0';
+    if (equals(line, "MOUNT")) {
+      rc = mdadm_mount();
+    } else if (equals(line, "UNMOUNT")) {
+      rc = mdadm_unmount();
+    } else if (equals(line, "SIGNALL")) {
+      if (cache_enabled() && cache_flush() != 1)
+        errx(1, "Failed to flush the cache before signing.");
+      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
+        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j)
+          jbod_sign_block(i, j);
+    } else {
+      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+        errx(1, "Failed to parse command: [%s\n], aborting.", line);
+      if (equals(cmd, "READ")) {
+        rc = mdadm_read(addr, len, buf);
+      } else if (equals(cmd, "WRITE")) {
+        memset(buf, ch, len);
+        rc = mdadm_write(addr, len, buf);
+      } else {
+        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
+      }
+    }
+
+    if (rc == -1)
+      errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
+  }
+  fclose(f);
+
+  if (cache_size)
+    cache_destroy();
+
+  jbod_print_cost();
+  print_seeks();
+  cache_print_hit_rate();
+  print_ghost_hit_rates(options);
+
+  mdadm_readahead_stats_t ra;
+  mdadm_readahead_stats(&ra);
+  if (ra.issued)
+    fprintf(stderr, "Read-ahead: %lu issued, %lu used, %lu wasted\n",
+            (unsigned long)ra.issued, (unsigned long)ra.used, (unsigned long)ra.wasted);
+
+  return 0;
+}
+
+typedef struct {
+  bool write;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t ch;
+} workload_io_t;
+
+typedef struct {
+  const workload_io_t *ios;
+  int num_ios;
+  int tid;
+  int num_threads;
+} workload_thread_t;
+
+/* Replays every |num_threads|-th I/O of a batch, starting at |tid|. */
+static void *workload_thread(void *arg) {
+  workload_thread_t *w = arg;
+  uint8_t buf[MAX_IO_SIZE];
+
+  for (int i = w->tid; i < w->num_ios; i += w->num_threads) {
+    const workload_io_t *io = &w->ios[i];
+    int rc;
+    if (io->write) {
+      memset(buf, io->ch, io->len);
+      rc = mdadm_write(io->addr, io->len, buf);
+    } else {
+      rc = mdadm_read(io->addr, io->len, buf);
+    }
+    if (rc == -1)
+      errx(1, "tester failed when processing %s %u %u", io->write ? "WRITE" : "READ",
+           io->addr, io->len);
+  }
+  return NULL;
+}
+
+/* Runs a batch of I/Os on |num_threads| threads and waits for all of them. */
+static void run_batch(const workload_io_t *ios, int num_ios, int num_threads) {
+  pthread_t threads[num_threads];
+  workload_thread_t args[num_threads];
+
+  for (int t = 0; t < num_threads; t++) {
+    args[t] = (workload_thread_t){ ios, num_ios, t, num_threads };
+    if (pthread_create(&threads[t], NULL, workload_thread, &args[t]) != 0)
+      errx(1, "Failed to start worker thread.");
+  }
+  for (int t = 0; t < num_threads; t++)
+    pthread_join(threads[t], NULL);
+}
+
+/* Like run_workload, but the reads and writes between two other commands are
+ * spread round-robin over |num_threads| threads, each taking its own share in
+ * trace order, over a cache with one shard per thread. Writes from different
+ * threads are not ordered, so the signatures only match the single-threaded
+ * run for traces whose concurrent writes do not overlap. Reports the
+ * throughput of the read and write commands. */
+int run_workload_threads(char *workload, int cache_size, cache_options_t *options,
+                         int num_threads) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+  int rc, num_ios = 0, cap = 1024, total_ios = 0;
+  double elapsed = 0;
+
+  FILE *f = fopen(workload, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", workload);
+
+  if (cache_size) {
+    if (options->shards == 0)
+      options->shards = num_threads;
+    rc = cache_create_ex(cache_size, options);
+    if (rc != 1)
+      errx(1, "Failed to create cache.");
+  }
+
+  workload_io_t *ios = malloc(cap * sizeof(workload_io_t));
+  int line_num = 0;
+  bool more = true;
+  while (more) {
+    more = fgets(line, 256, f) != NULL;
+    ++line_num;
+    if (more && !equals(line, "MOUNT") && !equals(line, "UNMOUNT") &&
+        !equals(line, "SIGNALL")) {
+      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+        errx(1, "Failed to parse command: [%s\n], aborting.", line);
+      if (!equals(cmd, "READ") && !equals(cmd, "WRITE"))
+        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
+      if (num_ios == cap)
+        ios = realloc(ios, (cap *= 2) * sizeof(workload_io_t));
+      ios[num_ios++] = (workload_io_t){ equals(cmd, "WRITE"), addr, len, ch };
+      continue;
+    }
+
+    if (num_ios) {
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      run_batch(ios, num_ios, num_threads);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      elapsed += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+      total_ios += num_ios;
+      num_ios = 0;
+    }
+    if (!more)
+      break;
+
+    rc = 0;
+    if (equals(line, "MOUNT")) {
+      rc = mdadm_mount();
+    } else if (equals(line, "UNMOUNT")) {
+      rc = mdadm_unmount();
+    } else {
+      if (cache_enabled() && cache_flush() != 1)
+        errx(1, "Failed to flush the cache before signing.");
+      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
+        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j)
+          jbod_sign_block(i, j);
+    }
+    if (rc == -1)
+      errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
+  }
+  fclose(f);
+  free(ios);
+
+  if (cache_size)
+    cache_destroy();
+
+  jbod_print_cost();
+  print_seeks();
+  cache_print_hit_rate();
+  print_ghost_hit_rates(options);
+  fprintf(stderr, "Throughput: %.0f ops/s with %d threads\n",
+          elapsed > 0 ? total_ios / elapsed : 0, num_threads);
+  return 0;
+}
+
+/* Like run_workload, but reads and writes are submitted asynchronously with
+ * up to |queue_depth| of them in flight; each other command waits for all of
+ * them first. Requests complete in submission order as far as their effects
+ * are concerned, so the signatures match a synchronous run. */
+int run_workload_async(char *workload, int cache_size, const cache_options_t *options,
+                       int queue_depth, const mdadm_aio_options_t *aio_options) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+  int rc, next = 0;
+  mdadm_aio_t *aios = calloc(queue_depth, sizeof(mdadm_aio_t));
+  uint8_t (*bufs)[MAX_IO_SIZE] = malloc(queue_depth * MAX_IO_SIZE);
+  bool *in_flight = calloc(queue_depth, sizeof(bool));
+
+  FILE *f = fopen(workload, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", workload);
+
+  if (cache_size) {
+    rc = cache_create_ex(cache_size, options);
+    if (rc != 1)
+      errx(1, "Failed to create cache.");
+  }
+  if (mdadm_aio_start_ex(queue_depth, aio_options) != 1)
+    errx(1, "Failed to start the asynchronous I/O worker.");
+
+  int line_num = 0;
+  while (fgets(line, 256, f)) {
+    ++line_num;
+    line[strlen(line)-1] = '\0';
+    if (equals(line, "MOUNT") || equals(line, "UNMOUNT") || equals(line, "SIGNALL")) {
+      mdadm_aio_drain();
+      for (int i = 0; i < queue_depth; i++) {
+        if (in_flight[i] && mdadm_aio_wait(&aios[i]) == -1)
+          errx(1, "tester failed on an asynchronous request before line %d", line_num);
+        in_flight[i] = false;
+      }
+    }
+    if (equals(line, "MOUNT")) {
+      rc = mdadm_mount();
+    } else if (equals(line, "UNMOUNT")) {
+      rc = mdadm_unmount();
+    } else if (equals(line, "SIGNALL")) {
+      if (cache_enabled() && cache_flush() != 1)
+        errx(1, "Failed to flush the cache before signing.");
+      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
+        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j)
+          jbod_sign_block(i, j);
+      rc = 0;
+    } else {
+      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+        errx(1, "Failed to parse command: [%s\n], aborting.", line);
+
+      /* Reuse the oldest slot once its request is done. */
+      mdadm_aio_t *aio = &aios[next];
+      if (in_flight[next] && mdadm_aio_wait(aio) == -1)
+        errx(1, "tester failed on an asynchronous request before line %d", line_num);
+      *aio = (mdadm_aio_t){ .addr = addr, .len = len, .buf = bufs[next] };
+      if (equals(cmd, "READ")) {
+        rc = mdadm_read_async(aio);
+      } else if (equals(cmd, "WRITE")) {
+        memset(bufs[next], ch, len);
+        rc = mdadm_write_async(aio);
+      } else {
+        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
+      }
+      in_flight[next] = true;
+      next = (next + 1) % queue_depth;
+    }
+
+    if (rc == -1)
+      errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
+  }
+  fclose(f);
+
+  mdadm_aio_stop();
+  if (cache_size)
+    cache_destroy();
+  free(aios);
+  free(bufs);
+  free(in_flight);
+
+  jbod_print_cost();
+  print_seeks();
+  cache_print_hit_rate();
+  print_ghost_hit_rates(options);
+  return 0;
+}
+
+int test_readahead() {
+  printf("running %s: ", __func__);
+
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  mdadm_readahead_stats_t ra;
+  const char *failure = NULL;
+
+  cache_create(64);
+  mdadm_mount();
+  mdadm_set_readahead(8);
+  mdadm_stats_reset();
+
+  /* Reads that each span two blocks, scattered over the volume, are not a
+   * stream, however many blocks each of them misses. */
+  for (int i = 0; i < 32; i++)
+    mdadm_read((i * 97 % 4000) * JBOD_BLOCK_SIZE + 100, JBOD_BLOCK_SIZE, buf);
+  mdadm_readahead_stats(&ra);
+  if (ra.issued != 0) {
+    failure = "scattered reads were taken for a stream";
+    goto out;
+  }
+
+  /* Reads each starting where the previous one ended are. */
+  for (int i = 0; i < 32; i++)
+    mdadm_read(200 * JBOD_BLOCK_SIZE + i * 100, 100, buf);
+  mdadm_readahead_stats(&ra);
+  if (ra.issued == 0 || ra.used == 0)
+    failure = "a sequential stream was not read ahead";
+
+out:
+  mdadm_set_readahead(0);
+  mdadm_unmount();
+  cache_destroy();
+  if (failure != NULL) {
+    printf("failed: %s.\n", failure);
+    return 0;
+  }
+
+  printf("passed\n");
+  return 1;
 }
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinylfu.h"
+
+#define TINYLFU_DEPTH 4
+#define TINYLFU_MAX_COUNT 15
+
+struct tinylfu {
+  int width;                 /* counters per row, a power of two */
+  uint8_t *counters;         /* TINYLFU_DEPTH rows of |width| counters */
+  int door_bits;             /* bits in the doorkeeper, a power of two */
+  uint64_t *doorkeeper;
+  int additions;             /* uses recorded since the last reset */
+  int sample_size;           /* uses between resets */
+  int *window;               /* ring of recently refused candidates */
+  int window_size;
+  int window_next;
+};
+
+/* Odd multipliers giving an independent hash per sketch row; the doorkeeper
+ * uses the first two. */
+static const uint32_t seeds[TINYLFU_DEPTH] = {
+  0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu,
+};
+
+static uint32_t hash(int key, int i) {
+  uint32_t h = ((uint32_t)key + 1) * seeds[i];
+  return h ^ (h >> 16);
+}
+
+static int pow2_at_least(int n) {
+  int p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+tinylfu_t *tinylfu_create(int num_entries) {
+  if (num_entries < 1)
+    return NULL;
+
+  tinylfu_t *t = calloc(1, sizeof(tinylfu_t));
+  if (t == NULL)
+    return NULL;
+  t->width = pow2_at_least(num_entries < 64 ? 64 : num_entries);
+  t->door_bits = pow2_at_least(num_entries < 64 ? 256 : 4 * num_entries);
+  t->sample_size = 10 * num_entries;
+  t->counters = calloc(TINYLFU_DEPTH, t->width);
+  t->doorkeeper = calloc(t->door_bits / 64, sizeof(uint64_t));
+  t->window_size = num_entries >= 16 ? num_entries / 16 : 1;
+  t->window = malloc(t->window_size * sizeof(int));
+  if (t->counters == NULL || t->doorkeeper == NULL || t->window == NULL) {
+    tinylfu_destroy(t);
+    return NULL;
+  }
+  for (int i = 0; i < t->window_size; i++)
+    t->window[i] = -1;
+  return t;
+}
+
+void tinylfu_destroy(tinylfu_t *t) {
+  if (t == NULL)
+    return;
+  free(t->counters);
+  free(t->doorkeeper);
+  free(t->window);
+  free(t);
+}
+
+static bool door_contains(const tinylfu_t *t, int key) {
+  for (int i = 0; i < 2; i++) {
+    uint32_t bit = hash(key, i) & (t->door_bits - 1);
+    if (!(t->doorkeeper[bit / 64] & (1ull << (bit % 64))))
+      return false;
+  }
+  return true;
+}
+
+static void door_add(tinylfu_t *t, int key) {
+  for (int i = 0; i < 2; i++) {
+    uint32_t bit = hash(key, i) & (t->door_bits - 1);
+    t->doorkeeper[bit / 64] |= 1ull << (bit % 64);
+  }
+}
+
+static uint8_t *counter(const tinylfu_t *t, int key, int row) {
+  return &t->counters[row * t->width + (hash(key, row) & (t->width - 1))];
+}
+
+/* Ages the filter: halves every counter and forgets the doorkeeper. */
+static void reset(tinylfu_t *t) {
+  for (int i = 0; i < TINYLFU_DEPTH * t->width; i++)
+    t->counters[i] >>= 1;
+  memset(t->doorkeeper, 0, t->door_bits / 8);
+  t->additions /= 2;
+}
+
+static int sketch_estimate(const tinylfu_t *t, int key) {
+  int min = TINYLFU_MAX_COUNT;
+  for (int row = 0; row < TINYLFU_DEPTH; row++) {
+    int c = *counter(t, key, row);
+    if (c < min)
+      min = c;
+  }
+  return min;
+}
+
+void tinylfu_record(tinylfu_t *t, int key) {
+  if (!door_contains(t, key)) {
+    door_add(t, key);
+  } else {
+    /* Conservative update: only the counters at the minimum grow, which
+     * keeps collisions from inflating the estimate. */
+    int min = sketch_estimate(t, key);
+    if (min < TINYLFU_MAX_COUNT) {
+      for (int row = 0; row < TINYLFU_DEPTH; row++) {
+        uint8_t *c = counter(t, key, row);
+        if (*c == min)
+          (*c)++;
+      }
+    }
+  }
+  if (++t->additions >= t->sample_size)
+    reset(t);
+}
+
+int tinylfu_estimate(const tinylfu_t *t, int key) {
+  return sketch_estimate(t, key) + door_contains(t, key);
+}
+
+bool tinylfu_admit(tinylfu_t *t, int candidate, int victim) {
+  /* A block refused a moment ago and already back is in a burst of uses
+   * the sketch has not caught up with yet, such as a read followed by a
+   * write of the same block. */
+  for (int i = 0; i < t->window_size; i++) {
+    if (t->window[i] == candidate) {
+      t->window[i] = -1;
+      return true;
+    }
+  }
+  if (tinylfu_estimate(t, candidate) > tinylfu_estimate(t, victim))
+    return true;
+  t->window[t->window_next] = candidate;
+  t->window_next = (t->window_next + 1) % t->window_size;
+  return false;
+}
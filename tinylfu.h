@@ -0,0 +1,35 @@
+#ifndef TINYLFU_H_
+#define TINYLFU_H_
+
+#include <stdbool.h>
+
+/* TinyLFU admission filter (Einziger, Friedman and Manes). It estimates how
+ * often each block has been used recently, so a cache can refuse to replace
+ * a frequently used block with one that is seldom used, such as a block a
+ * scan reads once.
+ *
+ * Uses go to a doorkeeper Bloom filter first, and only a block the
+ * doorkeeper has seen reaches the count-min sketch, whose counters are
+ * bytes that saturate at 15, as the paper's 4-bit counters would. Once
+ * as many uses as ten times the cache size have been recorded, every
+ * counter is halved and the doorkeeper cleared, so old popularity fades.
+ * Not thread-safe; cache.c keeps one per shard, under the shard lock. */
+typedef struct tinylfu tinylfu_t;
+
+/* Returns a filter for a cache of |num_entries| entries, or NULL. */
+tinylfu_t *tinylfu_create(int num_entries);
+
+void tinylfu_destroy(tinylfu_t *t);
+
+/* Records a use of the block with |key|. */
+void tinylfu_record(tinylfu_t *t, int key);
+
+/* Returns the estimated number of recent uses of the block with |key|. */
+int tinylfu_estimate(const tinylfu_t *t, int key);
+
+/* Returns true if the block with |candidate| should replace the one with
+ * |victim|, that is if it is estimated to be used more often, or if it was
+ * refused among the last num_entries / 16 refusals. */
+bool tinylfu_admit(tinylfu_t *t, int candidate, int victim);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <math.h>
+
+#include "jbod.h"
+#include "tester.h"
+#include "tracegen.h"
+
+#define TRACEGEN_ARGUMENTS "hn:S:z:k:p:r:s:q:uo:"
+#define USAGE                                                    \
+  "USAGE: tracegen [-h] [-n ops] [-S seed] [-z skew] [-k blocks]\n" \
+  "                [-p prob] [-r reads] [-s sizes] [-q run]\n"     \
+  "                [-u] [-o file]\n"                              \
+  "\n"                                                           \
+  "where:\n"                                                     \
+  "    -h - help mode (display this message)\n"                  \
+  "    -n - number of requests (default: 10000)\n"               \
+  "    -S - random seed (default: 1)\n"                          \
+  "    -z - Zipf exponent of block popularity (default: 0)\n"    \
+  "    -k - size of the hot set in blocks (default: 0)\n"        \
+  "    -p - fraction of requests to the hot set (default: 0)\n"  \
+  "    -r - fraction of requests that are reads (default: 0.5)\n" \
+  "    -s - request sizes: N, MIN-MAX (uniform) or eN\n"          \
+  "         (geometric with mean N), at most 1024 (default: 256)\n" \
+  "    -q - mean sequential run length (default: 1)\n"           \
+  "    -u - unaligned: start runs anywhere in a block\n"         \
+  "    -o - write the trace to this file (default: stdout)\n"    \
+  "\n"                                                           \
+
+#define NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define NUM_BYTES (NUM_BLOCKS * JBOD_BLOCK_SIZE)
+
+/* splitmix64: small, fast and fully determined by the seed, unlike get_rand
+ * in util.c, so a config always gives the same trace. */
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+/* Returns a uniform double in [0, 1). */
+static double rng_double(void) {
+  return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Returns a uniform integer in [0, n). */
+static uint32_t rng_below(uint32_t n) {
+  return rng_double() * n;
+}
+
+void tracegen_defaults(tracegen_config_t *config) {
+  *config = (tracegen_config_t){
+    .seed = 1,
+    .num_ops = 10000,
+    .read_ratio = 0.5,
+    .size_dist = TRACEGEN_SIZE_FIXED,
+    .size_min = JBOD_BLOCK_SIZE,
+    .size_max = JBOD_BLOCK_SIZE,
+    .run_length = 1,
+    .aligned = true,
+  };
+}
+
+static bool valid_config(const tracegen_config_t *c) {
+  return c->num_ops >= 0 && c->zipf >= 0 &&
+         c->hot_blocks >= 0 && c->hot_blocks <= NUM_BLOCKS &&
+         c->hot_prob >= 0 && c->hot_prob <= 1 &&
+         (c->hot_blocks > 0 || c->hot_prob == 0) &&
+         c->read_ratio >= 0 && c->read_ratio <= 1 &&
+         c->size_dist >= TRACEGEN_SIZE_FIXED && c->size_dist <= TRACEGEN_SIZE_EXP &&
+         c->size_min >= 1 && c->size_max <= MAX_IO_SIZE &&
+         c->size_min <= c->size_max && c->run_length >= 1;
+}
+
+static int draw_size(const tracegen_config_t *c) {
+  switch (c->size_dist) {
+    case TRACEGEN_SIZE_UNIFORM:
+      return c->size_min + rng_below(c->size_max - c->size_min + 1);
+    case TRACEGEN_SIZE_EXP: {
+      /* Geometric on 1, 2, ... with mean size_min. */
+      double p = 1.0 / c->size_min;
+      int size = p >= 1 ? 1 : 1 + (int)(log(1 - rng_double()) / log(1 - p));
+      return size < c->size_max ? size : c->size_max;
+    }
+    default:
+      return c->size_min;
+  }
+}
+
+/* Returns the index of the first entry of the ascending |cdf| of |n| entries
+ * above |x|, or n - 1. */
+static int search_cdf(const double *cdf, int n, double x) {
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cdf[mid] > x)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+int tracegen_write(FILE *f, const tracegen_config_t *config) {
+  static double cdf[NUM_BLOCKS];
+  static uint16_t blocks[NUM_BLOCKS];
+
+  if (f == NULL || config == NULL || !valid_config(config))
+    return -1;
+  rng_state = config->seed;
+
+  /* Popularity rank -> block, a random permutation; the hot set is the
+   * first hot_blocks entries of a second one. */
+  for (int i = 0; i < NUM_BLOCKS; i++)
+    blocks[i] = i;
+  for (int i = NUM_BLOCKS - 1; i > 0; i--) {
+    int j = rng_below(i + 1);
+    uint16_t t = blocks[i];
+    blocks[i] = blocks[j];
+    blocks[j] = t;
+  }
+  uint16_t hot[NUM_BLOCKS];
+  memcpy(hot, blocks, sizeof(hot));
+  for (int i = 0; i < config->hot_blocks; i++) {
+    int j = i + rng_below(NUM_BLOCKS - i);
+    uint16_t t = hot[i];
+    hot[i] = hot[j];
+    hot[j] = t;
+  }
+
+  double sum = 0;
+  for (int i = 0; i < NUM_BLOCKS; i++)
+    cdf[i] = sum += pow(i + 1, -config->zipf);
+  for (int i = 0; i < NUM_BLOCKS; i++)
+    cdf[i] /= sum;
+
+  fprintf(f, "MOUNT\n");
+  uint32_t next = 0;  /* where the current run continues */
+  for (int i = 0; i < config->num_ops; i++) {
+    bool read = rng_double() < config->read_ratio;
+    int len = draw_size(config);
+    uint32_t addr;
+
+    if (i > 0 && rng_double() >= 1 / config->run_length) {
+      addr = next;
+    } else {
+      int block;
+      if (config->hot_blocks > 0 && rng_double() < config->hot_prob)
+        block = hot[rng_below(config->hot_blocks)];
+      else
+        block = blocks[search_cdf(cdf, NUM_BLOCKS, rng_double())];
+      addr = block * JBOD_BLOCK_SIZE;
+      if (!config->aligned)
+        addr += rng_below(JBOD_BLOCK_SIZE);
+    }
+    if (addr + len > NUM_BYTES)
+      addr = NUM_BYTES - len;
+    next = (addr + len) % NUM_BYTES;
+
+    if (read)
+      fprintf(f, "READ %u %d 0\n", addr, len);
+    else
+      fprintf(f, "WRITE %u %d %u\n", addr, len, rng_below(256));
+  }
+  fprintf(f, "SIGNALL\nUNMOUNT\n");
+  return ferror(f) ? -1 : 1;
+}
+
+/* Parses the -s argument into |config|. Returns 1 on success and -1 on
+ * failure. */
+static int parse_sizes(const char *arg, tracegen_config_t *config) {
+  char *end;
+
+  if (arg[0] == 'e') {
+    config->size_dist = TRACEGEN_SIZE_EXP;
+    config->size_min = strtol(arg + 1, &end, 10);
+    config->size_max = MAX_IO_SIZE;
+  } else {
+    config->size_min = config->size_max = strtol(arg, &end, 10);
+    config->size_dist = TRACEGEN_SIZE_FIXED;
+    if (*end == '-') {
+      config->size_dist = TRACEGEN_SIZE_UNIFORM;
+      config->size_max = strtol(end + 1, &end, 10);
+    }
+  }
+  return *end == '\0' && valid_config(config) ? 1 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  const char *path = NULL;
+  tracegen_config_t config;
+
+  tracegen_defaults(&config);
+  while ((ch = getopt(argc, argv, TRACEGEN_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'n':
+        config.num_ops = atoi(optarg);
+        break;
+      case 'S':
+        config.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'z':
+        config.zipf = atof(optarg);
+        break;
+      case 'k':
+        config.hot_blocks = atoi(optarg);
+        break;
+      case 'p':
+        config.hot_prob = atof(optarg);
+        break;
+      case 'r':
+        config.read_ratio = atof(optarg);
+        break;
+      case 's':
+        if (parse_sizes(optarg, &config) == -1)
+          errx(1, "Invalid request sizes (%s), aborting.", optarg);
+        break;
+      case 'q':
+        config.run_length = atof(optarg);
+        break;
+      case 'u':
+        config.aligned = false;
+        break;
+      case 'o':
+        path = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (!valid_config(&config))
+    errx(1, "Invalid workload parameters, aborting.");
+
+  FILE *f = path ? fopen(path, "w") : stdout;
+  if (f == NULL)
+    err(1, "Cannot open %s", path);
+  if (tracegen_write(f, &config) == -1)
+    errx(1, "Failed to write the trace.");
+  if (path)
+    fclose(f);
+  return 0;
+}
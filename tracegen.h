@@ -0,0 +1,45 @@
+#ifndef TRACEGEN_H_
+#define TRACEGEN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* How request sizes are drawn. */
+typedef enum {
+  TRACEGEN_SIZE_FIXED,    /* always |size_min| */
+  TRACEGEN_SIZE_UNIFORM,  /* uniform in [size_min, size_max] */
+  TRACEGEN_SIZE_EXP,      /* geometric with mean |size_min|, capped at size_max */
+} tracegen_size_dist_t;
+
+typedef struct {
+  uint64_t seed;
+  int num_ops;
+  /* Zipf exponent of block popularity; 0 is uniform. The most popular
+   * blocks are scattered over the address space rather than adjacent. */
+  double zipf;
+  /* A fraction |hot_prob| of the requests that start a new run go to one of
+   * |hot_blocks| blocks chosen uniformly, the rest follow the Zipf law. */
+  int hot_blocks;
+  double hot_prob;
+  double read_ratio;  /* fraction of requests that are reads */
+  tracegen_size_dist_t size_dist;
+  int size_min;
+  int size_max;
+  /* Mean length of sequential runs, in requests: each request continues
+   * where the previous one ended with probability 1 - 1 / run_length. */
+  double run_length;
+  bool aligned;  /* start new runs on a block boundary */
+} tracegen_config_t;
+
+/* Fills |config| with the defaults: 10000 uniform, block-aligned, 256-byte
+ * requests, half of them reads, with no runs, hot set or skew. */
+void tracegen_defaults(tracegen_config_t *config);
+
+/* Returns 1 on success and -1 on failure. Writes a workload in the traces/
+ * input format described by |config| to |f|: MOUNT, the requests, SIGNALL
+ * and UNMOUNT. The same config always gives the same trace. Fails if the
+ * config is out of range. */
+int tracegen_write(FILE *f, const tracegen_config_t *config);
+
+#endif